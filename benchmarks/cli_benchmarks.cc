@@ -0,0 +1,714 @@
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <cstdio>
+#include <fcntl.h>
+#include <fstream>
+#include <new>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "cli/cli.h"
+
+/* Count heap allocations so that every benchmark can report allocs/op */
+static std::atomic<std::size_t> g_allocations{};
+
+/* The replacements below only call these. Kept out of line so that GCC does
+not inline free() into callers of operator new and warn about a mismatched
+pair (-Wmismatched-new-delete). */
+[[gnu::noinline]] static void* counted_allocate(std::size_t size, std::size_t alignment) {
+  g_allocations.fetch_add(1, std::memory_order_relaxed);
+
+  size = std::max<std::size_t>(size, 1);
+
+  if (alignment > alignof(std::max_align_t)) {
+    return std::aligned_alloc(alignment, (size + alignment - 1) & ~(alignment - 1));
+  }
+  return std::malloc(size);
+}
+
+[[gnu::noinline]] static void counted_deallocate(void* ptr) noexcept {
+  std::free(ptr);
+}
+
+void* operator new(std::size_t size) {
+  if (auto ptr = counted_allocate(size, alignof(std::max_align_t))) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+  return ::operator new(size);
+}
+
+/* std::pmr::new_delete_resource() allocates through the aligned forms */
+void* operator new(std::size_t size, std::align_val_t alignment) {
+  if (auto ptr = counted_allocate(size, std::size_t(alignment))) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment) {
+  return ::operator new(size, alignment);
+}
+
+void operator delete(void* ptr) noexcept {
+  counted_deallocate(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+  counted_deallocate(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+  counted_deallocate(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept {
+  counted_deallocate(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept {
+  counted_deallocate(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept {
+  counted_deallocate(ptr);
+}
+
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept {
+  counted_deallocate(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept {
+  counted_deallocate(ptr);
+}
+
+namespace {
+
+struct Allocation_counter {
+  explicit Allocation_counter(benchmark::State& state)
+    : m_state(state), m_start(g_allocations.load(std::memory_order_relaxed)) {}
+
+  ~Allocation_counter() {
+    const auto allocations = g_allocations.load(std::memory_order_relaxed) - m_start;
+    m_state.counters["allocs/op"] = benchmark::Counter(double(allocations), benchmark::Counter::kAvgIterations);
+  }
+
+  benchmark::State& m_state;
+  std::size_t m_start;
+};
+
+/* Owns the strings that a synthetic argv points into */
+struct Argv {
+  void push(std::string arg) {
+    m_args.push_back(std::move(arg));
+  }
+
+  char** data() {
+    m_argv.clear();
+    for (auto& arg : m_args) {
+      m_argv.push_back(arg.data());
+    }
+    return m_argv.data();
+  }
+
+  int size() const {
+    return int(m_args.size());
+  }
+
+  std::vector<std::string> m_args;
+  std::vector<char*> m_argv;
+};
+
+std::string option_name(std::size_t i) {
+  return std::format("option-{}", i);
+}
+
+/* Schema of n options cycling through the scalar and collection types */
+void add_schema(cli::Options& options, std::size_t n, bool with_env = false) {
+  for (std::size_t i = 0; i < n; ++i) {
+    cli::Option_descriptor desc{
+      .m_long_name = option_name(i),
+      .m_description = "Synthetic option"
+    };
+
+    if (with_env) {
+      desc.m_env_var = std::format("CLI_BENCH_{}", i);
+    }
+
+    switch (i % 4) {
+      case 0: desc.m_default_value = int(i); options.add_option<int>(desc); break;
+      case 1: desc.m_default_value = false; options.add_option<bool>(desc); break;
+      case 2: desc.m_default_value = std::string("value"); options.add_option<std::string>(desc); break;
+      case 3: desc.m_default_value = cli::Array_value<int>({1, 2, 3}); options.add_option<cli::Array_value<int>>(desc); break;
+    }
+  }
+}
+
+std::string option_value(std::size_t i) {
+  switch (i % 4) {
+    case 0: return std::to_string(i);
+    case 1: return "true";
+    case 2: return "text";
+    default: return "4,5,6";
+  }
+}
+
+/* argv setting every option of the schema once, cycling to reach tokens */
+Argv make_argv(std::size_t options, std::size_t tokens) {
+  Argv argv;
+
+  argv.push("program");
+
+  for (std::size_t i = 0; argv.m_args.size() <= tokens; ++i) {
+    const auto id = i % options;
+    argv.push(std::format("--{}={}", option_name(id), option_value(id)));
+  }
+  return argv;
+}
+
+std::string make_list(std::size_t n) {
+  std::string list;
+
+  for (std::size_t i = 0; i < n; ++i) {
+    list += (i == 0 ? "" : ",") + std::to_string(i * 31);
+  }
+  return list;
+}
+
+std::string make_map(std::size_t n) {
+  std::string map;
+
+  for (std::size_t i = 0; i < n; ++i) {
+    map += std::format("{}key{}={}", i == 0 ? "" : ",", i, i * 31);
+  }
+  return map;
+}
+
+/* Send stdout and stderr to /dev/null while rendering help */
+struct Silence_output {
+  Silence_output()
+    : m_stdout(dup(STDOUT_FILENO)), m_stderr(dup(STDERR_FILENO)) {
+    std::fflush(nullptr);
+    const int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+    dup2(null_fd, STDERR_FILENO);
+    close(null_fd);
+  }
+
+  ~Silence_output() {
+    std::cout.flush();
+    std::cerr.flush();
+    std::fflush(nullptr);
+    dup2(m_stdout, STDOUT_FILENO);
+    dup2(m_stderr, STDERR_FILENO);
+    close(m_stdout);
+    close(m_stderr);
+  }
+
+  int m_stdout;
+  int m_stderr;
+};
+
+} // namespace
+
+/* Parse one argument per option, for schemas of 10 to 10,000 options */
+static void BM_parse_schema(benchmark::State& state) {
+  const auto n = std::size_t(state.range(0));
+  cli::Options options;
+
+  add_schema(options, n);
+  auto argv = make_argv(n, n);
+
+  Allocation_counter counter(state);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(options.parse(argv.size(), argv.data()));
+  }
+  state.SetItemsProcessed(state.iterations() * std::int64_t(n));
+}
+BENCHMARK(BM_parse_schema)->RangeMultiplier(10)->Range(10, 10'000);
+
+/* Parse argv of up to 1M tokens against a 100 option schema */
+static void BM_parse_argv(benchmark::State& state) {
+  const auto tokens = std::size_t(state.range(0));
+  cli::Options options;
+
+  add_schema(options, 100);
+  auto argv = make_argv(100, tokens);
+
+  Allocation_counter counter(state);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(options.parse(argv.size(), argv.data()));
+  }
+  state.SetItemsProcessed(state.iterations() * std::int64_t(tokens));
+}
+BENCHMARK(BM_parse_argv)->RangeMultiplier(16)->Range(16, 1 << 20)->Unit(benchmark::kMicrosecond);
+
+/* 10,000 command lines of 10 options each against a 100 option schema */
+static void BM_parse_batch(benchmark::State& state) {
+  cli::Options options;
+
+  add_schema(options, 100);
+
+  auto argv = make_argv(100, 10);
+  std::vector<std::string_view> args(argv.m_args.begin() + 1, argv.m_args.end());
+  std::vector<std::span<const std::string_view>> batch(10'000, args);
+
+  Allocation_counter counter(state);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(options.parse_batch(batch, std::size_t(state.range(0))));
+  }
+  state.SetItemsProcessed(state.iterations() * std::int64_t(batch.size()));
+}
+BENCHMARK(BM_parse_batch)->RangeMultiplier(2)->Range(1, 8)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+/* The same batch on one thread, every entry in one arena released after
+the batch */
+static void BM_parse_batch_arena(benchmark::State& state) {
+  cli::Options options;
+
+  add_schema(options, 100);
+
+  auto argv = make_argv(100, 10);
+  std::vector<std::string_view> args(argv.m_args.begin() + 1, argv.m_args.end());
+  std::vector<std::span<const std::string_view>> batch(10'000, args);
+
+  std::pmr::monotonic_buffer_resource arena;
+  Allocation_counter counter(state);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(options.parse_batch(batch, 1, &arena));
+    arena.release();
+  }
+  state.SetItemsProcessed(state.iterations() * std::int64_t(batch.size()));
+}
+BENCHMARK(BM_parse_batch_arena)->Unit(benchmark::kMillisecond);
+
+/* A 100,000 element list that the program never reads, eager and lazy */
+static void BM_parse_unread_list(benchmark::State& state) {
+  cli::Options options;
+
+  options.add_option<cli::Array_value<int>>({.m_long_name = "numbers", .m_description = "Numbers"});
+  options.enable_lazy_collections(state.range(0) != 0);
+
+  Argv argv;
+  argv.push("program");
+  argv.push("--numbers=" + make_list(100'000));
+
+  Allocation_counter counter(state);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(options.parse(argv.size(), argv.data()));
+  }
+}
+BENCHMARK(BM_parse_unread_list)->Arg(0)->Arg(1)->Unit(benchmark::kMicrosecond);
+
+static void BM_get_by_name(benchmark::State& state) {
+  const auto n = std::size_t(state.range(0));
+  cli::Options options;
+
+  add_schema(options, n);
+
+  std::vector<std::string> storage;
+  for (std::size_t i = 0; i < n; i += 4) {
+    storage.push_back(option_name(i));
+  }
+
+  /* Names as views, e.g. cut out of a request, looked up without a copy */
+  std::vector<std::string_view> names(storage.begin(), storage.end());
+
+  Allocation_counter counter(state);
+
+  std::size_t i{};
+  for (auto _ : state) {
+    const auto name = names[i++ % names.size()];
+    benchmark::DoNotOptimize(options.has_value(name));
+    benchmark::DoNotOptimize(options.get<int>(name));
+  }
+}
+BENCHMARK(BM_get_by_name)->RangeMultiplier(10)->Range(10, 10'000);
+
+static void BM_get_by_handle(benchmark::State& state) {
+  const auto n = std::size_t(state.range(0));
+  cli::Options options;
+
+  std::vector<cli::Option_handle<int>> handles;
+  for (std::size_t i = 0; i < n; ++i) {
+    handles.push_back(options.add_option<int>({
+      .m_long_name = option_name(i),
+      .m_description = "Synthetic option",
+      .m_default_value = int(i)
+    }));
+  }
+
+  Allocation_counter counter(state);
+
+  std::size_t i{};
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(options[handles[i++ % handles.size()]]);
+  }
+}
+BENCHMARK(BM_get_by_handle)->RangeMultiplier(10)->Range(10, 10'000);
+
+/* Setting up, parsing and tearing down options with n options, with the
+default allocator (0) or in a monotonic arena (1) */
+static void BM_options_lifetime(benchmark::State& state) {
+  const auto n = std::size_t(state.range(0));
+  const bool use_arena = state.range(1) != 0;
+  auto argv = make_argv(n, n);
+
+  std::vector<std::byte> buffer(1 << 20);
+  Allocation_counter counter(state);
+
+  for (auto _ : state) {
+    std::pmr::monotonic_buffer_resource arena(buffer.data(), buffer.size());
+    cli::Options options(use_arena ? &arena : std::pmr::get_default_resource());
+
+    add_schema(options, n);
+    benchmark::DoNotOptimize(options.parse(argv.size(), argv.data()));
+  }
+  state.SetItemsProcessed(state.iterations() * std::int64_t(n));
+}
+BENCHMARK(BM_options_lifetime)->ArgsProduct({{10, 100, 1'000}, {0, 1}})->Unit(benchmark::kMicrosecond);
+
+/* Building a schema where every option has an environment variable set */
+static void BM_add_option_env(benchmark::State& state) {
+  const auto n = std::size_t(state.range(0));
+
+  for (std::size_t i = 0; i < n; ++i) {
+    setenv(std::format("CLI_BENCH_{}", i).c_str(), option_value(i).c_str(), 1);
+  }
+
+  Allocation_counter counter(state);
+
+  for (auto _ : state) {
+    cli::Options options;
+    add_schema(options, n, true);
+    benchmark::DoNotOptimize(options);
+  }
+  state.SetItemsProcessed(state.iterations() * std::int64_t(n));
+
+  for (std::size_t i = 0; i < n; ++i) {
+    unsetenv(std::format("CLI_BENCH_{}", i).c_str());
+  }
+}
+BENCHMARK(BM_add_option_env)->RangeMultiplier(10)->Range(10, 10'000)->Unit(benchmark::kMicrosecond);
+
+/* Building a schema of map options with 100 entry defaults, the descriptors
+are moved in */
+static void BM_add_option_large_default(benchmark::State& state) {
+  const auto n = std::size_t(state.range(0));
+
+  cli::Map_value<std::string, int> limits;
+
+  for (int i = 0; i < 100; ++i) {
+    limits[std::format("resource-{}", i)] = i;
+  }
+
+  Allocation_counter counter(state);
+
+  for (auto _ : state) {
+    cli::Options options;
+
+    for (std::size_t i = 0; i < n; ++i) {
+      options.add_option<cli::Map_value<std::string, int>>({
+        .m_short_name = std::format("l{}", i),
+        .m_long_name = option_name(i),
+        .m_description = "Synthetic option",
+        .m_default_value = limits
+      });
+    }
+    benchmark::DoNotOptimize(options);
+  }
+  state.SetItemsProcessed(state.iterations() * std::int64_t(n));
+}
+BENCHMARK(BM_add_option_large_default)->RangeMultiplier(10)->Range(10, 1'000)->Unit(benchmark::kMicrosecond);
+
+/* Same schema with the environment read in one pass by import_env() */
+static void BM_import_env(benchmark::State& state) {
+  const auto n = std::size_t(state.range(0));
+
+  for (std::size_t i = 0; i < n; ++i) {
+    setenv(std::format("CLI_BENCH_{}", i).c_str(), option_value(i).c_str(), 1);
+  }
+
+  Allocation_counter counter(state);
+
+  for (auto _ : state) {
+    cli::Options options;
+    options.defer_env();
+    add_schema(options, n, true);
+    benchmark::DoNotOptimize(options.import_env());
+  }
+  state.SetItemsProcessed(state.iterations() * std::int64_t(n));
+
+  for (std::size_t i = 0; i < n; ++i) {
+    unsetenv(std::format("CLI_BENCH_{}", i).c_str());
+  }
+}
+BENCHMARK(BM_import_env)->RangeMultiplier(10)->Range(10, 10'000)->Unit(benchmark::kMicrosecond);
+
+/* Startup of a tool with 20 modes of 50 options each, one invocation runs
+one mode. Arg 0 adds every option to one Options, arg 1 registers the modes
+as subcommands and builds only the selected one. */
+static void BM_subcommand_startup(benchmark::State& state) {
+  constexpr std::size_t commands = 20;
+  constexpr std::size_t options_per_command = 50;
+  const bool lazy = state.range(0) != 0;
+
+  auto add_options = [](cli::Options& options, std::size_t command) {
+    for (std::size_t i = 0; i < options_per_command; ++i) {
+      options.add_option<int>({
+        .m_long_name = std::format("cmd{}-{}", command, option_name(i)),
+        .m_description = "Synthetic option",
+        .m_default_value = int(i),
+        .m_env_var = std::format("CLI_BENCH_CMD{}_{}", command, i)
+      });
+    }
+  };
+
+  const char* flat_argv[] = {"tool", "--cmd7-option-0=1"};
+  const char* command_argv[] = {"tool", "cmd7", "--cmd7-option-0=1"};
+
+  Allocation_counter counter(state);
+
+  for (auto _ : state) {
+    if (lazy) {
+      cli::Subcommands registry;
+
+      for (std::size_t c = 0; c < commands; ++c) {
+        registry.add(std::format("cmd{}", c), "Synthetic command", [&, c] {
+          cli::Options options;
+          add_options(options, c);
+          return options;
+        });
+      }
+      benchmark::DoNotOptimize(registry.try_parse(3, const_cast<char**>(command_argv)));
+    } else {
+      cli::Options options;
+
+      for (std::size_t c = 0; c < commands; ++c) {
+        add_options(options, c);
+      }
+      benchmark::DoNotOptimize(options.parse(2, const_cast<char**>(flat_argv)));
+    }
+  }
+}
+BENCHMARK(BM_subcommand_startup)->Arg(0)->Arg(1)->Unit(benchmark::kMicrosecond);
+
+/* One tab press against the completion index of an n option schema, from
+mapping the index to printing the candidates */
+static void BM_complete(benchmark::State& state) {
+  const auto n = std::size_t(state.range(0));
+  cli::Options options;
+
+  add_schema(options, n);
+
+  const auto path = std::format("/tmp/cli_bench_{}.completion", getpid());
+  std::ofstream(path) << cli::Completion_index::write(options);
+
+  const std::string_view words[] = {"--option-1", "4", "--option-5"};
+  std::string out;
+
+  Allocation_counter counter(state);
+
+  for (auto _ : state) {
+    auto index = cli::Completion_index::open(path);
+
+    out.clear();
+    benchmark::DoNotOptimize(index->complete(words, out));
+  }
+  std::remove(path.c_str());
+}
+BENCHMARK(BM_complete)->RangeMultiplier(10)->Range(10, 10'000)->Unit(benchmark::kMicrosecond);
+
+static void BM_array_parse(benchmark::State& state) {
+  const auto list = make_list(std::size_t(state.range(0)));
+
+  Allocation_counter counter(state);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(cli::Array_value<int>::parse(list));
+  }
+  state.SetBytesProcessed(state.iterations() * std::int64_t(list.size()));
+}
+BENCHMARK(BM_array_parse)->RangeMultiplier(16)->Range(16, 1 << 20)->Unit(benchmark::kMicrosecond);
+
+template<template<typename, typename> typename Storage>
+static void BM_map_parse(benchmark::State& state) {
+  const auto map = make_map(std::size_t(state.range(0)));
+
+  Allocation_counter counter(state);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(cli::Map_value<std::string, int, Storage>::parse(map));
+  }
+  state.SetBytesProcessed(state.iterations() * std::int64_t(map.size()));
+}
+BENCHMARK(BM_map_parse<cli::Tree_map>)->RangeMultiplier(16)->Range(16, 1 << 16)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_map_parse<cli::Flat_map>)->RangeMultiplier(16)->Range(16, 1 << 16)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_map_parse<cli::Hash_map>)->RangeMultiplier(16)->Range(16, 1 << 16)->Unit(benchmark::kMicrosecond);
+
+/* Lookups of existing keys, cycling through the map */
+template<template<typename, typename> typename Storage>
+static void BM_map_lookup(benchmark::State& state) {
+  const auto n = std::size_t(state.range(0));
+  const auto map = cli::Map_value<std::string, int, Storage>::parse(make_map(n));
+
+  std::vector<std::string> keys;
+  for (std::size_t i = 0; i < n; ++i) {
+    keys.push_back(std::format("key{}", (i * 7919) % n));
+  }
+
+  std::size_t i{};
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(map->at(keys[i++ % n]));
+  }
+}
+BENCHMARK(BM_map_lookup<cli::Tree_map>)->RangeMultiplier(16)->Range(16, 1 << 16);
+BENCHMARK(BM_map_lookup<cli::Flat_map>)->RangeMultiplier(16)->Range(16, 1 << 16);
+BENCHMARK(BM_map_lookup<cli::Hash_map>)->RangeMultiplier(16)->Range(16, 1 << 16);
+
+/* Per request overrides on a frozen 100 option schema, reusing the overlay
+(0), or overriding one string option again and again without clearing (1).
+Strings are longer than the small string buffer. */
+static void BM_overlay(benchmark::State& state) {
+  cli::Options options;
+
+  add_schema(options, 100);
+
+  const auto snapshot = options.freeze();
+
+  /* option-0 is the first int option, option-2 the first string option */
+  const cli::Option_handle<int> port{0};
+  const cli::Assignment request[] = {{"option-0", "42"}, {"option-1", "true"}, {"option-2", "a value longer than sixteen bytes"}};
+  const std::string_view names[] = {"host-0.long.example.com", "host-1.long.example.com"};
+
+  cli::Overlay overlay(*snapshot);
+  const bool repeat = state.range(0) != 0;
+  std::size_t i{};
+
+  Allocation_counter counter(state);
+
+  for (auto _ : state) {
+    if (repeat) {
+      benchmark::DoNotOptimize(overlay.set("option-2", names[i++ & 1]));
+    } else {
+      overlay.clear();
+      benchmark::DoNotOptimize(overlay.set(request));
+      benchmark::DoNotOptimize(overlay[port]);
+    }
+  }
+}
+BENCHMARK(BM_overlay)->Arg(0)->Arg(1);
+
+/* Read every int option of a frozen schema, the loop of a program that
+reads its config in a hot path */
+static void BM_scan_values(benchmark::State& state) {
+  cli::Options options;
+  const auto n = std::size_t(state.range(0));
+
+  add_schema(options, n);
+
+  const auto snapshot = options.freeze();
+
+  for (auto _ : state) {
+    long sum{};
+
+    for (std::size_t id = 0; id < n; id += 4) {
+      sum += *(*snapshot)[cli::Option_handle<int>{id}];
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+}
+BENCHMARK(BM_scan_values)->RangeMultiplier(10)->Range(100, 10'000);
+
+/* Worker startup with a 100 option schema and a 10,000 host list: parsing
+the command line again (0) or mapping an image the parent wrote (1) */
+static void BM_worker_startup(benchmark::State& state) {
+  const bool use_image = state.range(0) != 0;
+
+  auto argv = make_argv(100, 100);
+  argv.push("--hosts=" + make_list(10'000));
+
+  auto add_options = [](cli::Options& options) {
+    add_schema(options, 100);
+    return options.add_option<cli::Array_value<std::string>>({.m_long_name = "hosts", .m_description = "Hosts"});
+  };
+
+  cli::Options parent;
+  add_options(parent);
+
+  if (!parent.parse(argv.size(), argv.data())) {
+    state.SkipWithError("parse failed");
+    return;
+  }
+
+  const int fd = ::memfd_create("options", MFD_CLOEXEC);
+
+  if (fd == -1 || !cli::Options_image::write(*parent.freeze(), fd)) {
+    state.SkipWithError("cannot write image");
+    return;
+  }
+
+  Allocation_counter counter(state);
+
+  for (auto _ : state) {
+    cli::Options options;
+    const auto hosts = add_options(options);
+
+    if (use_image) {
+      auto image = cli::Options_image::map(fd);
+      benchmark::DoNotOptimize(image->get(hosts)->size());
+    } else {
+      benchmark::DoNotOptimize(options.parse(argv.size(), argv.data()));
+      benchmark::DoNotOptimize(options[hosts]->size());
+    }
+  }
+  ::close(fd);
+}
+BENCHMARK(BM_worker_startup)->Arg(0)->Arg(1)->Unit(benchmark::kMicrosecond);
+
+static void BM_print_help(benchmark::State& state) {
+  cli::Options options;
+
+  add_schema(options, std::size_t(state.range(0)));
+
+  Silence_output silence;
+  Allocation_counter counter(state);
+
+  for (auto _ : state) {
+    options.print_help("program");
+  }
+}
+BENCHMARK(BM_print_help)->RangeMultiplier(10)->Range(10, 1'000)->Unit(benchmark::kMicrosecond);
+
+/* Arg 0 renders the help on every call, arg 1 writes the cached text to a
+descriptor */
+static void BM_print_help_fd(benchmark::State& state) {
+  cli::Options options;
+
+  add_schema(options, std::size_t(state.range(0)));
+
+  const int null_fd = open("/dev/null", O_WRONLY);
+  const bool cached = state.range(1) != 0;
+  Allocation_counter counter(state);
+
+  for (auto _ : state) {
+    if (!cached) {
+      /* Adding a validation invalidates the help text like a schema change */
+      options.add_validation(option_name(0), [](const cli::Value_variant&) { return true; });
+    }
+    benchmark::DoNotOptimize(options.print_help(null_fd, "program"));
+  }
+  close(null_fd);
+}
+BENCHMARK(BM_print_help_fd)->ArgsProduct({{10, 1'000}, {0, 1}})->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_MAIN();
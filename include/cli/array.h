@@ -4,19 +4,26 @@
 
 namespace cli {
 
-template<typename T>
+/* Option values use the default allocator, see Pmr_array_value for
+arrays in a memory resource */
+template<typename T, typename Allocator = std::allocator<T>>
 struct Array_value {
   using array_type = T;
   using value_type = array_type;
-  using iterator = typename std::vector<T>::iterator;
-  using const_iterator = typename std::vector<T>::const_iterator;
+  using allocator_type = Allocator;
+  using vector_type = std::vector<T, Allocator>;
+  using iterator = typename vector_type::iterator;
+  using const_iterator = typename vector_type::const_iterator;
 
   Array_value() = default;
 
-  explicit Array_value(const std::vector<T>& values)
+  explicit Array_value(const Allocator& alloc)
+    : m_values(alloc) {}
+
+  explicit Array_value(const vector_type& values)
     : m_values(values) {}
 
-  explicit Array_value(std::vector<T>&& values)
+  explicit Array_value(vector_type&& values)
     : m_values(std::move(values)) {}
 
   iterator begin() { return m_values.begin(); }
@@ -26,8 +33,8 @@ struct Array_value {
   const_iterator cbegin() const { return m_values.cbegin(); }
   const_iterator cend() const { return m_values.cend(); }
 
-  const std::vector<T>& values() const { return m_values; }
-  std::vector<T>& values() { return m_values; }
+  const vector_type& values() const { return m_values; }
+  vector_type& values() { return m_values; }
 
   size_t size() const { return m_values.size(); }
   bool empty() const { return m_values.empty(); }
@@ -37,31 +44,26 @@ struct Array_value {
 
   bool operator==(const Array_value& other) const = default;
 
-  static std::optional<Array_value<T>> parse(const std::string& input) {
-    try {
-      std::string item;
-      Array_value<T> result;
-      std::istringstream iss(input);
-
-      while (std::getline(iss, item, ',')) {
-        /* Trim whitespace */
-        item.erase(0, item.find_first_not_of(" \t"));
-        item.erase(item.find_last_not_of(" \t") + 1);
-
-        if constexpr (std::is_same_v<T, int>) {
-          result.m_values.push_back(std::stoi(item));
-        } else if constexpr (std::is_same_v<T, double>) {
-          result.m_values.push_back(std::stod(item));
-        } else if constexpr (std::is_same_v<T, bool>) {
-          result.m_values.push_back(is_true(item));
-        } else if constexpr (std::is_same_v<T, std::string>) {
-          result.m_values.push_back(item);
+  static std::optional<Array_value> parse(std::string_view input, const Allocator& alloc = Allocator()) {
+    Array_value result(alloc);
+    Tokenizer tokens(input);
+
+    result.m_values.reserve(tokens.count());
+
+    while (auto token = tokens.next()) {
+      if constexpr (std::constructible_from<T, std::string_view>) {
+        /* Strings are built in place, with the allocator of the array */
+        result.m_values.emplace_back(*token);
+      } else {
+        auto value = convert_token<T>(*token);
+
+        if (!value) {
+          return std::nullopt;
         }
+        result.m_values.push_back(*value);
       }
-      return result;
-    } catch (...) {
-      return std::nullopt;
     }
+    return result;
   }
 
   [[nodiscard]] std::string to_string() const {
@@ -79,7 +81,12 @@ struct Array_value {
   }
 
 private:
-  std::vector<T> m_values;
+  vector_type m_values;
 };
 
+/* Array in a memory resource. Use std::pmr::string elements to keep the
+strings in the resource too. */
+template<typename T>
+using Pmr_array_value = Array_value<T, std::pmr::polymorphic_allocator<T>>;
+
 } // namespace cli
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "cli/cli.h"
+
+#include <thread>
+
+namespace cli {
+
+/* Call fn(i) for every i in [0, n) on up to threads threads, the caller
+included. Each thread starts with an equal share of the indexes and, once
+its own share runs out, steals half of what is left of another thread's, so
+a few slow entries do not leave the other threads idle. */
+template<typename Fn>
+inline void parallel_for(std::size_t n, std::size_t threads, Fn&& fn) {
+  assert(n <= std::numeric_limits<std::uint32_t>::max());
+
+  threads = std::clamp<std::size_t>(threads, 1, std::max<std::size_t>(n, 1));
+
+  /* Remaining indexes of a thread as begin << 32 | end */
+  struct alignas(64) Range {
+    std::atomic<std::uint64_t> m_range{};
+  };
+
+  auto pack = [](std::uint64_t begin, std::uint64_t end) {
+    return begin << 32 | end;
+  };
+
+  std::vector<Range> ranges(threads);
+
+  for (std::size_t t = 0; t < threads; ++t) {
+    ranges[t].m_range.store(pack(n * t / threads, n * (t + 1) / threads), std::memory_order_relaxed);
+  }
+
+  auto run = [&](std::size_t self) {
+    auto& own = ranges[self].m_range;
+
+    for (;;) {
+      /* Take from the front of the own range */
+      for (auto range = own.load(std::memory_order_acquire); (range >> 32) < (range & 0xFFFFFFFF);) {
+        if (own.compare_exchange_weak(range, range + (std::uint64_t(1) << 32), std::memory_order_acq_rel)) {
+          fn(std::size_t(range >> 32));
+          range = own.load(std::memory_order_acquire);
+        }
+      }
+
+      /* Steal the back half of another range, done once all are empty */
+      bool stolen{};
+
+      for (std::size_t i = 1; i < threads && !stolen; ++i) {
+        auto& victim = ranges[(self + i) % threads].m_range;
+
+        for (auto range = victim.load(std::memory_order_acquire); !stolen;) {
+          const auto begin = range >> 32;
+          const auto end = range & 0xFFFFFFFF;
+
+          if (begin >= end) {
+            break;
+          }
+
+          const auto mid = begin + (end - begin) / 2;
+
+          if (victim.compare_exchange_weak(range, pack(begin, mid), std::memory_order_acq_rel)) {
+            own.store(pack(mid, end), std::memory_order_release);
+            stolen = true;
+          }
+        }
+      }
+
+      if (!stolen) {
+        return;
+      }
+    }
+  };
+
+  std::vector<std::jthread> workers;
+
+  workers.reserve(threads - 1);
+
+  for (std::size_t t = 1; t < threads; ++t) {
+    workers.emplace_back(run, t);
+  }
+
+  run(0);
+}
+
+inline std::vector<std::expected<Options, std::vector<Diagnostic>>> Options::parse_batch(std::span<const std::span<const std::string_view>> batch, std::size_t threads, std::pmr::memory_resource* resource) const {
+  std::vector<std::expected<Options, std::vector<Diagnostic>>> results(batch.size());
+
+  if (threads == 0) {
+    threads = std::max(1U, std::thread::hardware_concurrency());
+  }
+
+  /* The resource of these options may be an arena, which the workers must
+  not share. Without a resource the entries use the default one, which is
+  thread safe. */
+  if (resource == nullptr) {
+    resource = std::pmr::get_default_resource();
+  }
+
+  /* derive() reads these options and allocates only from resource */
+  parallel_for(batch.size(), threads, [&](std::size_t i) {
+    auto options = derive(resource);
+
+    if (auto result = options.try_parse(batch[i]); result) {
+      results[i] = std::move(options);
+    } else {
+      results[i] = std::unexpected(std::move(result.error()));
+    }
+  });
+
+  return results;
+}
+
+} // namespace cli
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "cli/cli.h"
+
+namespace cli {
+
+/* Binds options to the fields of a user struct, the fields are written
+every time an option is set, starting with its default:
+
+  struct Config {
+    int m_port{};
+    std::string m_host{};
+  };
+
+  Config config;
+  cli::Binder binder(options, config);
+
+  binder.bind(&Config::m_port, {.m_long_name = "port", .m_default_value = 8080});
+
+After parse() reading config.m_port is a plain member load. The options and
+the struct must outlive the binder's callbacks. */
+template<typename S>
+struct Binder {
+  Binder(Options& options, S& target)
+    : m_options(options), m_target(target) {}
+
+  /* Add an option that writes its value to target.*member */
+  template<Option_value T>
+  Option_handle<T> bind(T S::* member, const Option_descriptor& desc) {
+    auto handle = m_options.add_option<T>(desc);
+
+    bind(member, handle);
+
+    return handle;
+  }
+
+  /* Write an existing option, e.g. one from a schema, to target.*member */
+  template<Option_value T>
+  void bind(T S::* member, Option_handle<T> handle) {
+    m_options.on_change(handle, [target = &m_target, member](const T& value) {
+      target->*member = value;
+    });
+  }
+
+private:
+  Options& m_options;
+  S& m_target;
+};
+
+} // namespace cli
@@ -7,19 +7,33 @@
 #include <string>
 #include <vector>
 #include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <cerrno>
+#include <cctype>
 #include <charconv>
 #include <concepts>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <expected>
 #include <format>
 #include <functional>
 #include <iostream>
+#include <limits>
 #include <map>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
 #include <optional>
 #include <ranges>
+#include <span>
 #include <stdexcept>
 #include <string>
 #include <string_view>
 #include <unordered_map>
+#include <utility>
 #include <variant>
 #include <vector>
 
@@ -31,6 +45,42 @@ namespace cli {
   return value == "true" || value == "on" || value == "1" || value == "yes";
 }
 
+/* Transparent hash so that maps keyed by std::string can be probed with a std::string_view */
+struct String_hash {
+  using is_transparent = void;
+
+  [[nodiscard]] std::size_t operator()(std::string_view value) const noexcept {
+    return std::hash<std::string_view>{}(value);
+  }
+};
+
+template<typename V>
+using String_map = std::unordered_map<std::string, V, String_hash, std::equal_to<>>;
+
+/* String_map with its nodes and keys in a memory resource. Probe it with
+std::string_view, a std::string key does not compare with std::pmr::string. */
+template<typename V>
+using Pmr_string_map = std::pmr::unordered_map<std::pmr::string, V, String_hash, std::equal_to<>>;
+
+/* Convert a number without allocating, the whole input must be consumed */
+template<typename T>
+requires std::same_as<T, int> || std::same_as<T, double>
+[[nodiscard]] inline std::optional<T> parse_number(std::string_view value) noexcept {
+  /* std::from_chars does not accept a leading '+' */
+  if (value.size() > 1 && value[0] == '+' && value[1] != '-') {
+    value.remove_prefix(1);
+  }
+
+  T result{};
+  const auto end = value.data() + value.size();
+  const auto [ptr, ec] = std::from_chars(value.data(), end, result);
+
+  if (ec != std::errc{} || ptr != end || value.empty()) {
+    return std::nullopt;
+  }
+  return result;
+}
+
 /* Error types */
 struct Option_error : public std::runtime_error {
   explicit Option_error(const std::string& msg) : std::runtime_error(msg) {}
@@ -44,8 +94,92 @@ struct Validation_error : public Option_error {
   explicit Validation_error(const std::string& msg) : Option_error(msg) {}
 };
 
+/* Report a programming error (bad option setup). Without exception support
+the error is logged and the process aborts. */
+template<typename E>
+[[noreturn]] inline void throw_error(const std::string& msg) {
+#if defined(__cpp_exceptions)
+  throw E(msg);
+#else
+  log_error(msg);
+  std::abort();
+#endif
+}
+
+/* Errors in user input are reported as diagnostics, never thrown */
+enum class Diagnostic_code {
+  unknown_option,
+  invalid_value,
+  validation_failed,
+  missing_required,
+  bad_response_file,
+  read_error,
+  bad_config_file,
+  too_many_overrides,
+  bad_image,
+  missing_command,
+  unknown_command,
+  bad_completion_index
+};
+
+struct Diagnostic {
+  [[nodiscard]] inline std::string to_string() const {
+    switch (m_code) {
+      case Diagnostic_code::unknown_option:
+        return std::format("Unknown option: {}", m_option);
+      case Diagnostic_code::invalid_value:
+        return std::format("Invalid value '{}' for option '{}'", m_value, m_option);
+      case Diagnostic_code::validation_failed:
+        return std::format("Validation failed for option '{}'", m_option);
+      case Diagnostic_code::missing_required:
+        return std::format("Required option '{}' is missing", m_option);
+      case Diagnostic_code::bad_response_file:
+        return std::format("Cannot expand response file '{}': {}", m_option, m_value);
+      case Diagnostic_code::read_error:
+        return std::format("Cannot read positional arguments: {}", m_value);
+      case Diagnostic_code::bad_config_file:
+        return std::format("Cannot read config file '{}': {}", m_option, m_value);
+      case Diagnostic_code::too_many_overrides:
+        return std::format("Too many overrides, cannot set option '{}'", m_option);
+      case Diagnostic_code::bad_image:
+        return std::format("Cannot load options image '{}': {}", m_option, m_value);
+      case Diagnostic_code::missing_command:
+        return "Missing command";
+      case Diagnostic_code::unknown_command:
+        return std::format("Unknown command: {}", m_option);
+      case Diagnostic_code::bad_completion_index:
+        return std::format("Cannot load completion index '{}': {}", m_option, m_value);
+    }
+    return {};
+  }
+
+  Diagnostic_code m_code{};
+
+  /* Option name as given by the user, or the long name */
+  std::string m_option{};
+
+  /* Offending raw value, if any */
+  std::string m_value{};
+
+  /* Position in argv, 0 if the diagnostic is not tied to an argument */
+  int m_arg_index{};
+};
+
 } // namespace cli
 
+#include "cli/tokenizer.h"
 #include "cli/array.h"
 #include "cli/map.h"
+#include "cli/schema.h"
+#include "cli/response_file.h"
+#include "cli/stream.h"
+#include "cli/env.h"
 #include "cli/options.h"
+#include "cli/bind.h"
+#include "cli/snapshot.h"
+#include "cli/overlay.h"
+#include "cli/batch.h"
+#include "cli/config_file.h"
+#include "cli/image.h"
+#include "cli/subcommand.h"
+#include "cli/completion.h"
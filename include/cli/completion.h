@@ -0,0 +1,531 @@
+#pragma once
+
+#include "cli/cli.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace cli {
+
+/* Shell completion from a precomputed index. The index is written once, e.g.
+at install time, from the options or subcommands of a tool. On every tab
+press the shell runs "tool __complete <words>", complete_main() maps the
+index and prints the candidates, before the tool builds any options.
+
+Layout, all integers in host byte order:
+
+  Completion_header
+  Completion_context[context_count]   sorted by name, "" is the top level
+  Completion_word[word_count]         the words of each context, sorted
+  Image_ref[value_count]              values of the options that take one
+  data                                strings, referenced by offset
+
+The top level holds the options of a plain Options, or the command names of
+Subcommands, with one context per command for its options. Words are
+"--long" and "-s" option names and command names. A prefix matches a run of
+adjacent words in a context, found with a binary search. */
+
+struct Completion_header {
+  static constexpr std::array<char, 8> magic{'C', 'L', 'I', 'C', 'O', 'M', 'P', 'L'};
+  static constexpr std::uint32_t current_version = 1;
+
+  std::array<char, 8> m_magic{magic};
+  std::uint32_t m_version{current_version};
+  std::uint32_t m_byte_order{Image_header::byte_order};
+  std::uint64_t m_size{};
+  std::uint32_t m_context_count{};
+  std::uint32_t m_word_count{};
+  std::uint32_t m_value_count{};
+
+  /* Whether the top level holds command names */
+  std::uint32_t m_has_commands{};
+};
+
+struct Completion_context {
+  Image_ref m_name{};
+
+  /* Run of words in the word table */
+  std::uint32_t m_first{};
+  std::uint32_t m_count{};
+};
+
+struct Completion_word {
+  Image_ref m_word{};
+
+  /* Run of candidate values in the value table */
+  std::uint32_t m_first_value{};
+  std::uint32_t m_value_count{};
+
+  /* Whether the next argument is the value of this option, false for
+  flags and commands */
+  std::uint32_t m_takes_value{};
+  std::uint32_t m_reserved{};
+};
+
+/* Candidate values of options by the name their value is stored under.
+bool options complete to true and false unless listed here. */
+using Completion_values = String_map<std::vector<std::string>>;
+
+enum class Completion_shell {
+  bash,
+  zsh,
+  fish
+};
+
+/* First argument that puts a tool in completion mode */
+inline constexpr std::string_view completion_command = "__complete";
+
+struct Completion_index {
+  /* Index of the options of a tool */
+  [[nodiscard]] static inline std::string write(const Options& options, const Completion_values& values = {});
+
+  /* Index of the commands of a tool and of the options of each, built by
+  running every factory once */
+  [[nodiscard]] static inline std::string write(const Subcommands& commands, const Completion_values& values = {});
+
+  [[nodiscard]] static inline std::expected<Completion_index, Diagnostic> open(const std::string& path);
+
+  /* Read an index in a buffer, which must outlive the index */
+  [[nodiscard]] static inline std::expected<Completion_index, Diagnostic> view(std::string_view data);
+
+  /* Append the candidates for the last of words, the word being completed,
+  one per line. words are the arguments after the program name. Returns the
+  number of candidates. */
+  inline std::size_t complete(std::span<const std::string_view> words, std::string& out) const;
+
+private:
+  struct Word {
+    std::string m_word{};
+    bool m_takes_value{};
+    std::vector<std::string> m_values{};
+  };
+
+  struct Context {
+    std::string m_name{};
+    std::vector<Word> m_words{};
+  };
+
+  static inline void add_options(Context& context, const Options& options, const Completion_values& values);
+
+  [[nodiscard]] static inline std::string write(std::vector<Context> contexts, bool has_commands);
+
+  [[nodiscard]] Completion_header header() const noexcept {
+    return image_read<Completion_header>(m_data, 0);
+  }
+
+  /* Context with its run of words cut to the word table */
+  [[nodiscard]] Completion_context context(std::size_t index) const noexcept {
+    auto c = image_read<Completion_context>(m_data, sizeof(Completion_header) + index * sizeof(Completion_context));
+    const auto count = header().m_word_count;
+
+    c.m_first = std::min(c.m_first, count);
+    c.m_count = std::min(c.m_count, count - c.m_first);
+    return c;
+  }
+
+  /* Word with its run of values cut to the value table */
+  [[nodiscard]] Completion_word word(std::size_t index) const noexcept {
+    auto w = image_read<Completion_word>(m_data, words_offset() + index * sizeof(Completion_word));
+    const auto count = header().m_value_count;
+
+    w.m_first_value = std::min(w.m_first_value, count);
+    w.m_value_count = std::min(w.m_value_count, count - w.m_first_value);
+    return w;
+  }
+
+  [[nodiscard]] std::string_view value(std::size_t index) const noexcept {
+    return text(image_read<Image_ref>(m_data, values_offset() + index * sizeof(Image_ref)));
+  }
+
+  /* Offsets of the word and value tables */
+  [[nodiscard]] std::size_t words_offset() const noexcept {
+    return sizeof(Completion_header) + header().m_context_count * sizeof(Completion_context);
+  }
+
+  [[nodiscard]] std::size_t values_offset() const noexcept {
+    return words_offset() + header().m_word_count * sizeof(Completion_word);
+  }
+
+  /* Empty if the string is out of bounds */
+  [[nodiscard]] std::string_view text(Image_ref ref) const noexcept {
+    if (ref.m_offset > m_data.size() || ref.m_size > m_data.size() - ref.m_offset) {
+      return {};
+    }
+    return m_data.substr(ref.m_offset, ref.m_size);
+  }
+
+  /* Context by name, a binary search */
+  [[nodiscard]] inline std::optional<Completion_context> find_context(std::string_view name) const noexcept;
+
+  /* Index of the first word of context not less than prefix */
+  [[nodiscard]] inline std::size_t lower_bound(const Completion_context& context, std::string_view prefix) const noexcept;
+
+  [[nodiscard]] inline std::optional<Completion_word> find_word(const Completion_context& context, std::string_view name) const noexcept;
+
+  /* Check the header and the table sizes. Offsets in the tables are checked
+  as they are read, so opening an index does not read all of it. */
+  [[nodiscard]] inline std::optional<std::string> check() const;
+
+  Mapped_file m_file;
+  std::string_view m_data;
+};
+
+inline void Completion_index::add_options(Context& context, const Options& options, const Completion_values& values) {
+  const auto& schema = options.m_schema;
+  const auto& table = *options.m_table;
+
+  for (std::size_t id = 0; id < options.m_values.size(); ++id) {
+    const auto short_name = schema.empty() ? std::string_view(table.m_descriptors[id].m_short_name) : schema.m_specs[id].m_short_name;
+    const auto long_name = schema.empty() ? std::string_view(table.m_descriptors[id].m_long_name) : schema.m_specs[id].m_long_name;
+    const bool is_flag = option_type(schema, table, id) == type_of<bool>;
+
+    Word word{.m_takes_value = !is_flag};
+
+    if (auto it = values.find(long_name.empty() ? short_name : long_name); it != values.end()) {
+      word.m_values = it->second;
+    } else if (is_flag) {
+      word.m_values = {"true", "false"};
+    }
+
+    if (!long_name.empty()) {
+      word.m_word = std::format("--{}", long_name);
+      context.m_words.push_back(word);
+    }
+    if (!short_name.empty()) {
+      word.m_word = std::format("-{}", short_name);
+      context.m_words.push_back(std::move(word));
+    }
+  }
+}
+
+inline std::string Completion_index::write(const Options& options, const Completion_values& values) {
+  std::vector<Context> contexts(1);
+
+  add_options(contexts[0], options, values);
+  return write(std::move(contexts), false);
+}
+
+inline std::string Completion_index::write(const Subcommands& commands, const Completion_values& values) {
+  std::vector<Context> contexts(1);
+
+  for (const auto& entry : commands.m_commands) {
+    contexts[0].m_words.push_back({.m_word = entry.m_name});
+
+    auto& context = contexts.emplace_back(Context{.m_name = entry.m_name});
+    add_options(context, entry.m_factory(), values);
+  }
+  return write(std::move(contexts), true);
+}
+
+inline std::string Completion_index::write(std::vector<Context> contexts, bool has_commands) {
+  std::ranges::sort(contexts, {}, &Context::m_name);
+
+  std::size_t word_count{}, value_count{};
+
+  for (auto& context : contexts) {
+    std::ranges::sort(context.m_words, {}, &Word::m_word);
+    word_count += context.m_words.size();
+
+    for (const auto& word : context.m_words) {
+      value_count += word.m_values.size();
+    }
+  }
+
+  const auto words_offset = sizeof(Completion_header) + contexts.size() * sizeof(Completion_context);
+  const auto values_offset = words_offset + word_count * sizeof(Completion_word);
+
+  std::string out(values_offset + value_count * sizeof(Image_ref), '\0');
+  std::size_t word_index{}, value_index{};
+
+  for (std::size_t c = 0; c < contexts.size(); ++c) {
+    const Completion_context context{
+      .m_name = image_append_string(out, contexts[c].m_name),
+      .m_first = std::uint32_t(word_index),
+      .m_count = std::uint32_t(contexts[c].m_words.size())
+    };
+    std::memcpy(out.data() + sizeof(Completion_header) + c * sizeof(Completion_context), &context, sizeof(context));
+
+    for (const auto& w : contexts[c].m_words) {
+      const Completion_word word{
+        .m_word = image_append_string(out, w.m_word),
+        .m_first_value = std::uint32_t(value_index),
+        .m_value_count = std::uint32_t(w.m_values.size()),
+        .m_takes_value = w.m_takes_value
+      };
+      std::memcpy(out.data() + words_offset + word_index++ * sizeof(Completion_word), &word, sizeof(word));
+
+      for (const auto& v : w.m_values) {
+        const auto ref = image_append_string(out, v);
+        std::memcpy(out.data() + values_offset + value_index++ * sizeof(Image_ref), &ref, sizeof(ref));
+      }
+    }
+  }
+
+  if (out.size() > std::numeric_limits<std::uint32_t>::max()) {
+    throw_error<Option_error>("Completion index larger than 4 GiB");
+  }
+
+  const Completion_header header{
+    .m_size = out.size(),
+    .m_context_count = std::uint32_t(contexts.size()),
+    .m_word_count = std::uint32_t(word_count),
+    .m_value_count = std::uint32_t(value_count),
+    .m_has_commands = has_commands
+  };
+  std::memcpy(out.data(), &header, sizeof(header));
+
+  return out;
+}
+
+inline std::expected<Completion_index, Diagnostic> Completion_index::open(const std::string& path) {
+  auto fail = [&](std::string error) {
+    return std::unexpected(Diagnostic{.m_code = Diagnostic_code::bad_completion_index, .m_option = path, .m_value = std::move(error)});
+  };
+
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+  if (fd == -1) {
+    return fail(std::strerror(errno));
+  }
+
+  auto file = Mapped_file::map(fd);
+  ::close(fd);
+
+  if (!file) {
+    return fail(std::strerror(errno));
+  }
+
+  auto index = view(file->view());
+
+  if (!index) {
+    index.error().m_option = path;
+  } else {
+    index->m_file = std::move(*file);
+  }
+  return index;
+}
+
+inline std::expected<Completion_index, Diagnostic> Completion_index::view(std::string_view data) {
+  Completion_index index;
+  index.m_data = data;
+
+  if (auto error = index.check()) {
+    return std::unexpected(Diagnostic{.m_code = Diagnostic_code::bad_completion_index, .m_value = std::move(*error)});
+  }
+  return index;
+}
+
+inline std::optional<std::string> Completion_index::check() const {
+  if (m_data.size() < sizeof(Completion_header)) {
+    return "truncated header";
+  }
+
+  const auto h = header();
+
+  if (h.m_magic != Completion_header::magic) {
+    return "not a completion index";
+  }
+  if (h.m_byte_order != Image_header::byte_order) {
+    return "written on a host of another byte order";
+  }
+  if (h.m_version != Completion_header::current_version) {
+    return std::format("unsupported version {}", h.m_version);
+  }
+
+  const auto tables = std::uint64_t(h.m_context_count) * sizeof(Completion_context) + std::uint64_t(h.m_word_count) * sizeof(Completion_word) + std::uint64_t(h.m_value_count) * sizeof(Image_ref);
+
+  if (h.m_size != m_data.size() || tables > m_data.size() - sizeof(Completion_header)) {
+    return "truncated";
+  }
+
+  return std::nullopt;
+}
+
+inline std::optional<Completion_context> Completion_index::find_context(std::string_view name) const noexcept {
+  std::size_t lo{}, hi{header().m_context_count};
+
+  while (lo < hi) {
+    const auto mid = lo + (hi - lo) / 2;
+    const auto c = context(mid);
+    const auto n = text(c.m_name);
+
+    if (n == name) {
+      return c;
+    } else if (n < name) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return std::nullopt;
+}
+
+inline std::size_t Completion_index::lower_bound(const Completion_context& context, std::string_view prefix) const noexcept {
+  std::size_t lo{context.m_first}, hi{context.m_first + context.m_count};
+
+  while (lo < hi) {
+    const auto mid = lo + (hi - lo) / 2;
+
+    if (text(word(mid).m_word) < prefix) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+inline std::optional<Completion_word> Completion_index::find_word(const Completion_context& context, std::string_view name) const noexcept {
+  if (const auto i = lower_bound(context, name); i < context.m_first + context.m_count) {
+    if (const auto w = word(i); text(w.m_word) == name) {
+      return w;
+    }
+  }
+  return std::nullopt;
+}
+
+inline std::size_t Completion_index::complete(std::span<const std::string_view> words, std::string& out) const {
+  const std::string_view current = words.empty() ? std::string_view{} : words.back();
+  auto args = words.empty() ? words : words.first(words.size() - 1);
+  auto context = find_context("");
+
+  /* The first argument names the command, whose options follow */
+  if (header().m_has_commands && !args.empty()) {
+    context = find_context(args.front());
+    args = args.subspan(1);
+  }
+
+  if (!context) {
+    return 0;
+  }
+
+  /* Option whose value is being completed, "--name=value", "--name value",
+  or "--name = value" as bash splits words at '=' */
+  std::string_view option, prefix, lead;
+
+  /* Flags only take a value after '=' */
+  bool attached{true};
+
+  if (const auto eq = current.find('='); current.starts_with("--") && eq != std::string_view::npos) {
+    option = current.substr(0, eq);
+    lead = current.substr(0, eq + 1);
+    prefix = current.substr(eq + 1);
+  } else if (current == "=" && !args.empty()) {
+    option = args.back();
+  } else if (args.size() > 1 && args.back() == "=") {
+    option = args[args.size() - 2];
+    prefix = current;
+  } else if (!args.empty() && !current.starts_with('-')) {
+    option = args.back();
+    prefix = current;
+    attached = false;
+  }
+
+  std::size_t count{};
+
+  if (auto w = option.empty() ? std::nullopt : find_word(*context, option); w && (w->m_takes_value || attached)) {
+    for (std::size_t i = w->m_first_value; i < w->m_first_value + w->m_value_count; ++i) {
+      if (const auto v = value(i); v.starts_with(prefix)) {
+        out.append(lead);
+        out.append(v);
+        out.push_back('\n');
+        ++count;
+      }
+    }
+    return count;
+  }
+
+  for (auto i = lower_bound(*context, current); i < context->m_first + context->m_count; ++i) {
+    const auto w = text(word(i).m_word);
+
+    if (!w.starts_with(current)) {
+      break;
+    }
+    out.append(w);
+    out.push_back('\n');
+    ++count;
+  }
+  return count;
+}
+
+/* Script that registers completion of program with shell, source it from
+the shell startup file or install it where the shell looks for completions */
+[[nodiscard]] inline std::string completion_script(Completion_shell shell, std::string_view program) {
+  /* Shell function names allow letters, digits and '_' */
+  std::string function = "_";
+
+  for (const char c : program) {
+    function.push_back(std::isalnum(static_cast<unsigned char>(c)) ? c : '_');
+  }
+
+  switch (shell) {
+    case Completion_shell::bash:
+      return std::format(
+        "{}_complete() {{\n"
+        "  local IFS=$'\\n'\n"
+        "  COMPREPLY=($({} {} \"${{COMP_WORDS[@]:1:COMP_CWORD}}\" 2>/dev/null))\n"
+        "}}\n"
+        "complete -o default -F {}_complete {}\n",
+        function, program, completion_command, function, program);
+    case Completion_shell::zsh:
+      return std::format(
+        "#compdef {}\n"
+        "{}_complete() {{\n"
+        "  local -a candidates\n"
+        "  candidates=(${{(f)\"$({} {} \"${{(@)words[2,CURRENT]}}\" 2>/dev/null)\"}})\n"
+        "  compadd -a candidates\n"
+        "}}\n"
+        "compdef {}_complete {}\n",
+        program, function, program, completion_command, function, program);
+    case Completion_shell::fish:
+      return std::format(
+        "complete -c {} -f -a '({} {} (commandline -opc)[2..-1] (commandline -ct) 2>/dev/null)'\n",
+        program, program, completion_command);
+  }
+  return {};
+}
+
+/* Completion mode entry point, call it first thing in main():
+
+  if (auto status = cli::complete_main(argc, argv, "/usr/share/tool/tool.completion")) {
+    return *status;
+  }
+
+Returns std::nullopt unless argv[1] is completion_command. Otherwise prints
+the candidates for the remaining arguments with a single write and returns
+the exit status, 1 if the index cannot be read. */
+[[nodiscard]] inline std::optional<int> complete_main(int argc, char* argv[], const std::string& index_path) {
+  if (argc < 2 || argv[1] != completion_command) {
+    return std::nullopt;
+  }
+
+  const auto index = Completion_index::open(index_path);
+
+  if (!index) {
+    return 1;
+  }
+
+  std::vector<std::string_view> words(argv + 2, argv + argc);
+
+  /* "tool __complete" completes an empty word */
+  if (words.empty()) {
+    words.emplace_back();
+  }
+
+  std::string out;
+  index->complete(words, out);
+
+  for (std::size_t pos = 0; pos < out.size();) {
+    const auto n = ::write(STDOUT_FILENO, out.data() + pos, out.size() - pos);
+
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n < 0) {
+      return 1;
+    }
+    pos += std::size_t(n);
+  }
+  return 0;
+}
+
+} // namespace cli
@@ -0,0 +1,295 @@
+#pragma once
+
+#include "cli/cli.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <thread>
+#include <unistd.h>
+
+namespace cli {
+
+/* Split config file text into assignments that are views into text. Each
+line is "name = value" with the value in command line syntax, blank lines
+and lines starting with '#' are skipped. Lines without '=' are ignored. */
+inline void parse_config(std::string_view text, std::vector<Assignment>& out) {
+  while (!text.empty()) {
+    const auto eol = std::min(find_byte(text, '\n'), text.size());
+    const auto line = trim(text.substr(0, eol));
+
+    text.remove_prefix(std::min(eol + 1, text.size()));
+
+    if (line.empty() || line.starts_with('#')) {
+      continue;
+    }
+
+    if (const auto sep = find_byte(line, '='); sep != std::string_view::npos) {
+      out.push_back({trim(line.substr(0, sep)), trim(line.substr(sep + 1))});
+    }
+  }
+}
+
+/* Options source backed by a config file that can be reloaded while the
+program runs. A reload only converts and validates the entries whose text
+changed since the last load, and applies them all or none, so change
+callbacks (Options::on_change) fire only for options that really changed.
+The value of an entry removed from the file is dropped, the option falls
+back to its default value.
+
+Watching is done with inotify on the parent directory, which also catches
+editors and deploy tools that replace the file with a rename. After start()
+the options are written from the watcher thread, other threads must read
+them through the snapshots given to the Snapshot_publisher. */
+struct Config_file {
+  using Error_callback = std::function<void(const std::vector<Diagnostic>&)>;
+
+  Config_file(Options& options, std::string path, Snapshot_publisher* publisher = nullptr)
+    : m_options(options), m_path(std::move(path)), m_publisher(publisher) {}
+
+  ~Config_file() {
+    stop();
+
+    if (m_inotify_fd != -1) {
+      ::close(m_inotify_fd);
+    }
+  }
+
+  Config_file(const Config_file&) = delete;
+  Config_file& operator=(const Config_file&) = delete;
+
+  /* Read the file and apply the entries that changed or were removed.
+  Returns the number of options set or reset. A new snapshot is published if
+  anything changed. */
+  [[nodiscard]] std::expected<std::size_t, std::vector<Diagnostic>> load() {
+    auto text = read_file();
+
+    if (!text) {
+      return std::unexpected(std::vector<Diagnostic>{{
+        .m_code = Diagnostic_code::bad_config_file,
+        .m_option = m_path,
+        .m_value = std::strerror(text.error())
+      }});
+    }
+
+    std::vector<Assignment> entries;
+    std::vector<Assignment> changed;
+
+    parse_config(**text, entries);
+    ++m_loads;
+
+    /* Each changed value gets its own copy, which std::string_view options
+    may point into, so the file text is not kept */
+    std::vector<std::shared_ptr<const std::string>> values;
+
+    for (const auto& entry : entries) {
+      auto it = m_applied.find(entry.m_name);
+
+      if (it != m_applied.end()) {
+        it->second.m_load = m_loads;
+      }
+
+      if (it == m_applied.end() || *it->second.m_value != entry.m_value) {
+        const auto& value = values.emplace_back(std::make_shared<const std::string>(entry.m_value));
+        changed.push_back({entry.m_name, *value});
+      }
+    }
+
+    std::size_t count{};
+
+    if (!changed.empty()) {
+      auto result = m_options.set(changed);
+
+      if (!result) {
+        return result;
+      }
+      count = *result;
+    }
+
+    /* The copy of a value replaces the one of the value before it, so the
+    options retain one buffer per entry however often the file changes */
+    for (std::size_t i = 0; i < changed.size(); ++i) {
+      auto& applied = m_applied[std::string(changed[i].m_name)];
+
+      m_options.retain(values[i], applied.m_value.get());
+      applied = {.m_value = std::move(values[i]), .m_load = m_loads};
+    }
+
+    /* Entries that are no longer in the file */
+    for (auto it = m_applied.begin(); it != m_applied.end();) {
+      if (it->second.m_load == m_loads) {
+        ++it;
+        continue;
+      }
+
+      if (m_options.reset(it->first, Value_source::file)) {
+        ++count;
+      }
+      m_options.release(it->second.m_value.get());
+      it = m_applied.erase(it);
+    }
+
+    if (count > 0 && m_publisher != nullptr) {
+      m_publisher->publish(m_options.freeze());
+    }
+    return count;
+  }
+
+  /* Start watching the file, returns errno on failure */
+  [[nodiscard]] std::expected<void, int> watch() {
+    if (m_inotify_fd != -1) {
+      return {};
+    }
+
+    const auto slash = m_path.find_last_of('/');
+    const auto dir = slash == std::string::npos ? std::string(".") : m_path.substr(0, std::max<std::size_t>(slash, 1));
+
+    m_name = slash == std::string::npos ? m_path : m_path.substr(slash + 1);
+    m_inotify_fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if (m_inotify_fd == -1) {
+      return std::unexpected(errno);
+    }
+
+    if (::inotify_add_watch(m_inotify_fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) == -1) {
+      const auto error = errno;
+      ::close(m_inotify_fd);
+      m_inotify_fd = -1;
+      return std::unexpected(error);
+    }
+    return {};
+  }
+
+  /* Descriptor to wait on in an event loop, -1 until watch() */
+  [[nodiscard]] int fd() const noexcept {
+    return m_inotify_fd;
+  }
+
+  /* Wait up to timeout_ms for the file to change and reload it. Returns
+  whether it changed, diagnostics if the reload failed. */
+  [[nodiscard]] std::expected<bool, std::vector<Diagnostic>> poll(int timeout_ms) {
+    if (m_inotify_fd == -1) {
+      return false;
+    }
+
+    pollfd pfd{.fd = m_inotify_fd, .events = POLLIN, .revents = 0};
+
+    if (::poll(&pfd, 1, timeout_ms) <= 0) {
+      return false;
+    }
+
+    /* Drain the events, reload once if any was for our file */
+    alignas(inotify_event) char buffer[4096];
+    bool changed{};
+
+    for (;;) {
+      const auto n = ::read(m_inotify_fd, buffer, sizeof(buffer));
+
+      if (n <= 0) {
+        break;
+      }
+
+      for (std::size_t pos = 0; pos < std::size_t(n);) {
+        const auto* event = reinterpret_cast<const inotify_event*>(buffer + pos);
+
+        if (event->len > 0 && std::string_view(event->name) == m_name) {
+          changed = true;
+        }
+        pos += sizeof(inotify_event) + event->len;
+      }
+    }
+
+    if (!changed) {
+      return false;
+    }
+
+    if (auto result = load(); !result) {
+      return std::unexpected(std::move(result.error()));
+    }
+    return true;
+  }
+
+  /* Watch and reload from a background thread until stop() */
+  [[nodiscard]] std::expected<void, int> start(Error_callback on_error = {}) {
+    if (auto result = watch(); !result) {
+      return result;
+    }
+
+    m_thread = std::jthread([this, on_error = std::move(on_error)](std::stop_token stop) {
+      while (!stop.stop_requested()) {
+        if (auto result = poll(100); !result) {
+          if (on_error) {
+            on_error(result.error());
+          } else {
+            for (const auto& diagnostic : result.error()) {
+              log_error(diagnostic.to_string());
+            }
+          }
+        }
+      }
+    });
+    return {};
+  }
+
+  void stop() {
+    if (m_thread.joinable()) {
+      m_thread.request_stop();
+      m_thread.join();
+    }
+  }
+
+private:
+  [[nodiscard]] std::expected<std::shared_ptr<const std::string>, int> read_file() const {
+    /* Copied rather than mapped, the file may be rewritten in place */
+    const int fd = ::open(m_path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1) {
+      return std::unexpected(errno);
+    }
+
+    auto text = std::make_shared<std::string>();
+    char buffer[16 * 1024];
+
+    for (;;) {
+      const auto n = ::read(fd, buffer, sizeof(buffer));
+
+      if (n < 0 && errno == EINTR) {
+        continue;
+      } else if (n < 0) {
+        const auto error = errno;
+        ::close(fd);
+        return std::unexpected(error);
+      } else if (n == 0) {
+        break;
+      }
+      text->append(buffer, std::size_t(n));
+    }
+
+    ::close(fd);
+    return text;
+  }
+
+  Options& m_options;
+  std::string m_path;
+  Snapshot_publisher* m_publisher{};
+
+  /* File name inside the watched directory */
+  std::string m_name;
+  int m_inotify_fd{-1};
+
+  struct Applied {
+    /* Text of the entry, retained by the options */
+    std::shared_ptr<const std::string> m_value;
+
+    /* Last load that found the entry in the file */
+    std::uint64_t m_load{};
+  };
+
+  /* Entries as last applied */
+  String_map<Applied> m_applied;
+  std::uint64_t m_loads{};
+
+  std::jthread m_thread;
+};
+
+} // namespace cli
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "cli/cli.h"
+
+#include <unistd.h>
+
+namespace cli {
+
+/* Call fn(name, value) for every entry of the environment. The views point
+into environ, nothing is copied. */
+template<typename Fn>
+inline void for_each_env(Fn&& fn) {
+  for (char** entry = environ; entry != nullptr && *entry != nullptr; ++entry) {
+    const std::string_view text(*entry);
+
+    if (const auto sep = text.find('='); sep != std::string_view::npos) {
+      fn(text.substr(0, sep), text.substr(sep + 1));
+    }
+  }
+}
+
+/* Environment variable of an option under a prefix, e.g. APP_MAX_CONNECTIONS
+for prefix "APP_" and long name "max-connections" */
+[[nodiscard]] inline std::string env_var_name(std::string_view prefix, std::string_view long_name) {
+  std::string name(prefix);
+
+  name.reserve(prefix.size() + long_name.size());
+
+  for (auto c : long_name) {
+    name.push_back(c == '-' ? '_' : char(std::toupper(static_cast<unsigned char>(c))));
+  }
+  return name;
+}
+
+} // namespace cli
@@ -0,0 +1,591 @@
+#pragma once
+
+#include "cli/cli.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace cli {
+
+/* Binary image of parsed option values, written once by a parent process
+and mapped by workers, which read the values in place instead of parsing
+the same command line again.
+
+Layout, all integers in host byte order:
+
+  Image_header
+  Image_entry[count]     one per option id, so handles index it directly
+  std::uint32_t[count]   option ids sorted by name, for lookups by name
+  data                   strings and collections, referenced by offset
+
+Scalars live in the entry. A string is an (offset, length) Image_ref, an
+array is a run of elements and a map is a run of key Image_refs followed
+by a run of values, sorted by key. bool elements are one byte, int four,
+double and Image_ref eight. Nothing is aligned, values are read with
+memcpy, so an image can also be read from a plain buffer. */
+
+struct Image_ref {
+  std::uint32_t m_offset{};
+  std::uint32_t m_size{};
+};
+
+struct Image_header {
+  static constexpr std::array<char, 8> magic{'C', 'L', 'I', 'I', 'M', 'A', 'G', 'E'};
+  static constexpr std::uint32_t current_version = 1;
+
+  /* Written as 0x01020304, reads differently on a host of the other byte order */
+  static constexpr std::uint32_t byte_order = 0x01020304;
+
+  std::array<char, 8> m_magic{magic};
+  std::uint32_t m_version{current_version};
+  std::uint32_t m_byte_order{byte_order};
+
+  /* Hash of the option names and types by id, see Options_image::schema_hash() */
+  std::uint64_t m_schema_hash{};
+  std::uint64_t m_size{};
+  std::uint32_t m_count{};
+  std::uint32_t m_reserved{};
+};
+
+struct Image_entry {
+  static constexpr std::uint8_t no_value = 0xFF;
+
+  Image_ref m_name{};
+
+  /* Value_variant alternative of the option */
+  std::uint8_t m_type{};
+
+  /* Value_variant alternative of the value, no_value if it has none */
+  std::uint8_t m_value_type{no_value};
+
+  std::uint16_t m_reserved{};
+
+  /* String length or number of elements */
+  std::uint32_t m_count{};
+
+  /* Scalar bits, or offset of the string or of the first element */
+  std::uint64_t m_payload{};
+};
+
+/* Read a trivially copyable T stored at offset of data */
+template<typename T>
+[[nodiscard]] inline T image_read(std::string_view data, std::size_t offset) noexcept {
+  T value;
+  std::memcpy(&value, data.data() + offset, sizeof(T));
+  return value;
+}
+
+/* Size of an element of type E in an image */
+template<typename E>
+inline constexpr std::size_t image_element_size = std::same_as<E, std::string_view> ? sizeof(Image_ref) : std::same_as<E, bool> ? 1 : sizeof(E);
+
+/* Element of type E at offset, E is bool, int, double or std::string_view */
+template<typename E>
+[[nodiscard]] inline E image_element(std::string_view data, std::size_t offset) noexcept {
+  if constexpr (std::same_as<E, std::string_view>) {
+    const auto ref = image_read<Image_ref>(data, offset);
+    return data.substr(ref.m_offset, ref.m_size);
+  } else if constexpr (std::same_as<E, bool>) {
+    return data[offset] != 0;
+  } else {
+    return image_read<E>(data, offset);
+  }
+}
+
+/* Array_value read in place */
+template<typename E>
+struct Image_array {
+  struct iterator {
+    using value_type = E;
+    using difference_type = std::ptrdiff_t;
+
+    E operator*() const noexcept { return (*m_array)[m_index]; }
+
+    iterator& operator++() noexcept {
+      ++m_index;
+      return *this;
+    }
+
+    iterator operator++(int) noexcept {
+      auto it = *this;
+      ++m_index;
+      return it;
+    }
+
+    bool operator==(const iterator& other) const = default;
+
+    const Image_array* m_array{};
+    std::size_t m_index{};
+  };
+
+  [[nodiscard]] std::size_t size() const noexcept { return m_size; }
+  [[nodiscard]] bool empty() const noexcept { return m_size == 0; }
+
+  [[nodiscard]] E operator[](std::size_t index) const noexcept {
+    return image_element<E>(m_data, m_offset + index * image_element_size<E>);
+  }
+
+  iterator begin() const noexcept { return {this, 0}; }
+  iterator end() const noexcept { return {this, m_size}; }
+
+  std::string_view m_data{};
+  std::size_t m_offset{};
+  std::size_t m_size{};
+};
+
+/* Map_value read in place, keys are sorted so find() is a binary search */
+template<typename V>
+struct Image_map {
+  [[nodiscard]] std::size_t size() const noexcept { return m_size; }
+  [[nodiscard]] bool empty() const noexcept { return m_size == 0; }
+
+  [[nodiscard]] std::string_view key(std::size_t index) const noexcept {
+    return image_element<std::string_view>(m_data, m_offset + index * sizeof(Image_ref));
+  }
+
+  [[nodiscard]] V value(std::size_t index) const noexcept {
+    return image_element<V>(m_data, m_offset + m_size * sizeof(Image_ref) + index * image_element_size<V>);
+  }
+
+  [[nodiscard]] std::optional<V> find(std::string_view key) const noexcept {
+    std::size_t lo{}, hi{m_size};
+
+    while (lo < hi) {
+      const auto mid = lo + (hi - lo) / 2;
+      const auto k = this->key(mid);
+
+      if (k == key) {
+        return value(mid);
+      } else if (k < key) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    return std::nullopt;
+  }
+
+  std::string_view m_data{};
+  std::size_t m_offset{};
+  std::size_t m_size{};
+};
+
+/* Type an image value of an option holding a T is read as */
+template<typename T>
+struct Image_type_of {
+  using type = T;
+};
+
+template<>
+struct Image_type_of<std::string> {
+  using type = std::string_view;
+};
+
+template<typename T>
+struct Image_type_of<Array_value<T>> {
+  using type = Image_array<typename Image_type_of<T>::type>;
+};
+
+template<typename V>
+struct Image_type_of<Map_value<std::string, V>> {
+  using type = Image_map<typename Image_type_of<V>::type>;
+};
+
+template<Option_value T>
+using Image_type = typename Image_type_of<T>::type;
+
+/* Options image mapped from a file or memfd, or read from a buffer that
+outlives it. Values are read through the handles of options with the same
+schema, check matches() first, or by name. */
+struct Options_image {
+  /* Serialize the current values of a snapshot */
+  [[nodiscard]] static inline std::string write(const Options_snapshot& snapshot);
+
+  /* Serialize to fd, e.g. a memfd the workers inherit. Returns errno on failure. */
+  [[nodiscard]] static inline std::expected<void, int> write(const Options_snapshot& snapshot, int fd);
+
+  [[nodiscard]] static inline std::expected<Options_image, Diagnostic> open(const std::string& path);
+
+  /* Map an open file, the descriptor can be closed afterwards */
+  [[nodiscard]] static inline std::expected<Options_image, Diagnostic> map(int fd);
+
+  /* Read an image in a buffer, which must outlive the image */
+  [[nodiscard]] static inline std::expected<Options_image, Diagnostic> view(std::string_view data);
+
+  /* Hash of the option names and types by id */
+  [[nodiscard]] std::uint64_t schema_hash() const noexcept {
+    return header().m_schema_hash;
+  }
+
+  [[nodiscard]] static inline std::uint64_t schema_hash(const Options& options);
+
+  /* Whether handles of options index this image */
+  [[nodiscard]] bool matches(const Options& options) const {
+    return schema_hash(options) == schema_hash();
+  }
+
+  /* Number of options */
+  [[nodiscard]] std::size_t size() const noexcept {
+    return header().m_count;
+  }
+
+  /* Value by handle of options the image matches(), std::nullopt if the
+  option has no value or another type */
+  template<Option_value T>
+  [[nodiscard]] std::optional<Image_type<T>> get(Option_handle<T> handle) const noexcept {
+    if (handle.m_id >= size()) {
+      return std::nullopt;
+    }
+    return value<T>(entry(handle.m_id));
+  }
+
+  /* Value by name, a binary search over the names */
+  template<Option_value T>
+  [[nodiscard]] std::optional<Image_type<T>> get(std::string_view name) const noexcept {
+    if (auto id = find(name)) {
+      return value<T>(entry(*id));
+    }
+    return std::nullopt;
+  }
+
+  [[nodiscard]] bool has_value(std::string_view name) const noexcept {
+    auto id = find(name);
+    return id && entry(*id).m_value_type != Image_entry::no_value;
+  }
+
+private:
+  [[nodiscard]] Image_header header() const noexcept {
+    return image_read<Image_header>(m_data, 0);
+  }
+
+  [[nodiscard]] Image_entry entry(std::size_t id) const noexcept {
+    return image_read<Image_entry>(m_data, sizeof(Image_header) + id * sizeof(Image_entry));
+  }
+
+  [[nodiscard]] std::string_view name(const Image_entry& entry) const noexcept {
+    return m_data.substr(entry.m_name.m_offset, entry.m_name.m_size);
+  }
+
+  [[nodiscard]] inline std::optional<std::size_t> find(std::string_view name) const noexcept;
+
+  template<Option_value T>
+  [[nodiscard]] std::optional<Image_type<T>> value(const Image_entry& entry) const noexcept {
+    if (entry.m_value_type != type_of<T>) {
+      return std::nullopt;
+    }
+
+    using I = Image_type<T>;
+
+    if constexpr (std::same_as<I, std::string_view>) {
+      return m_data.substr(entry.m_payload, entry.m_count);
+    } else if constexpr (Basic_value<T>) {
+      T v;
+      std::memcpy(&v, &entry.m_payload, sizeof(T));
+      return v;
+    } else {
+      return I{m_data, std::size_t(entry.m_payload), entry.m_count};
+    }
+  }
+
+  /* Check every offset once, so reads need no bounds checks */
+  [[nodiscard]] inline std::optional<std::string> check() const;
+
+  template<typename Value>
+  static inline void write_value(std::string& out, Image_entry& entry, const Value& value);
+
+  Mapped_file m_file;
+  std::string_view m_data;
+};
+
+/* Append a string to an image being written */
+inline Image_ref image_append_string(std::string& out, std::string_view text) {
+  const Image_ref ref{std::uint32_t(out.size()), std::uint32_t(text.size())};
+  out.append(text);
+  return ref;
+}
+
+/* Fixed size elements of a collection being written. Strings are appended
+to out and their Image_refs returned in their place. */
+template<typename Range>
+[[nodiscard]] inline std::string image_elements(std::string& out, const Range& values) {
+  using E = std::ranges::range_value_t<Range>;
+
+  std::string elements;
+
+  for (const auto& value : values) {
+    if constexpr (std::same_as<E, std::string>) {
+      const auto ref = image_append_string(out, value);
+      elements.append(reinterpret_cast<const char*>(&ref), sizeof(ref));
+    } else if constexpr (std::same_as<E, bool>) {
+      elements.push_back(char(value ? 1 : 0));
+    } else {
+      elements.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+  }
+  return elements;
+}
+
+/* Hash of the names and types of count options, in id order */
+[[nodiscard]] inline std::uint64_t image_schema_hash(const Schema_view& schema, const Option_table& table, std::size_t count) {
+  std::uint64_t hash = count;
+
+  for (std::size_t id = 0; id < count; ++id) {
+    const auto key = schema.empty() ? std::string_view(value_key(table.m_descriptors[id])) : schema.m_specs[id].key();
+    hash = schema_hash(key, false, hash + option_type(schema, table, id));
+  }
+  return hash;
+}
+
+inline std::uint64_t Options_image::schema_hash(const Options& options) {
+  return image_schema_hash(options.m_schema, *options.m_table, options.m_values.size());
+}
+
+template<typename Value>
+inline void Options_image::write_value(std::string& out, Image_entry& entry, const Value& value) {
+  if constexpr (std::same_as<Value, std::string> || std::same_as<Value, std::string_view>) {
+    const auto ref = image_append_string(out, value);
+    entry.m_payload = ref.m_offset;
+    entry.m_count = ref.m_size;
+  } else if constexpr (Basic_value<Value>) {
+    std::memcpy(&entry.m_payload, &value, sizeof(Value));
+  } else if constexpr (requires { typename Value::array_type; }) {
+    const auto elements = image_elements(out, value.values());
+
+    entry.m_payload = out.size();
+    entry.m_count = std::uint32_t(value.size());
+    out.append(elements);
+  } else {
+    /* std::map iterates in key order, which Image_map::find() relies on */
+    const auto keys = image_elements(out, value.values() | std::views::keys);
+    const auto values = image_elements(out, value.values() | std::views::values);
+
+    entry.m_payload = out.size();
+    entry.m_count = std::uint32_t(value.size());
+    out.append(keys);
+    out.append(values);
+  }
+}
+
+inline std::string Options_image::write(const Options_snapshot& snapshot) {
+  const auto& schema = snapshot.m_schema;
+  const auto& table = *snapshot.m_table;
+  const auto& values = snapshot.m_values;
+  const auto count = values.size();
+
+  std::string out(sizeof(Image_header) + count * (sizeof(Image_entry) + sizeof(std::uint32_t)), '\0');
+  std::vector<Image_entry> entries(count);
+  std::vector<std::pair<std::string_view, std::uint32_t>> names(count);
+
+  for (std::size_t id = 0; id < count; ++id) {
+    auto& entry = entries[id];
+    const auto key = schema.empty() ? std::string_view(value_key(table.m_descriptors[id])) : schema.m_specs[id].key();
+
+    names[id] = {key, std::uint32_t(id)};
+    entry.m_name = image_append_string(out, key);
+    entry.m_type = std::uint8_t(option_type(schema, table, id));
+
+    if (!values.has_value(id)) {
+      continue;
+    }
+
+    std::visit([&](const auto& type) {
+      using T = std::decay_t<decltype(type)>;
+
+      /* Lazy values are converted here, invalid ones are left out */
+      if (const auto* value = values.template get<T>(id, table.m_validators)) {
+        entry.m_value_type = std::uint8_t(type_of<T>);
+        write_value(out, entry, *value);
+      }
+    }, empty_value(values.m_types[id]));
+  }
+
+  if (out.size() > std::numeric_limits<std::uint32_t>::max()) {
+    throw_error<Option_error>("Options image larger than 4 GiB");
+  }
+
+  std::ranges::sort(names);
+
+  Image_header header{.m_schema_hash = image_schema_hash(schema, table, count), .m_size = out.size(), .m_count = std::uint32_t(count)};
+  auto* index = out.data() + sizeof(Image_header) + count * sizeof(Image_entry);
+
+  std::memcpy(out.data(), &header, sizeof(header));
+  std::memcpy(out.data() + sizeof(Image_header), entries.data(), count * sizeof(Image_entry));
+
+  for (std::size_t i = 0; i < count; ++i) {
+    std::memcpy(index + i * sizeof(std::uint32_t), &names[i].second, sizeof(std::uint32_t));
+  }
+  return out;
+}
+
+inline std::expected<void, int> Options_image::write(const Options_snapshot& snapshot, int fd) {
+  const auto image = write(snapshot);
+
+  for (std::size_t pos = 0; pos < image.size();) {
+    const auto n = ::write(fd, image.data() + pos, image.size() - pos);
+
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n < 0) {
+      return std::unexpected(errno);
+    }
+    pos += std::size_t(n);
+  }
+  return {};
+}
+
+inline std::expected<Options_image, Diagnostic> Options_image::open(const std::string& path) {
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+  if (fd == -1) {
+    return std::unexpected(Diagnostic{.m_code = Diagnostic_code::bad_image, .m_option = path, .m_value = std::strerror(errno)});
+  }
+
+  auto image = map(fd);
+  ::close(fd);
+
+  if (!image) {
+    image.error().m_option = path;
+  }
+  return image;
+}
+
+inline std::expected<Options_image, Diagnostic> Options_image::map(int fd) {
+  auto file = Mapped_file::map(fd);
+
+  if (!file) {
+    return std::unexpected(Diagnostic{.m_code = Diagnostic_code::bad_image, .m_value = std::strerror(errno)});
+  }
+
+  const auto data = file->view();
+  auto image = view(data);
+
+  if (image) {
+    image->m_file = std::move(*file);
+  }
+  return image;
+}
+
+inline std::expected<Options_image, Diagnostic> Options_image::view(std::string_view data) {
+  Options_image image;
+  image.m_data = data;
+
+  if (auto error = image.check()) {
+    return std::unexpected(Diagnostic{.m_code = Diagnostic_code::bad_image, .m_value = std::move(*error)});
+  }
+  return image;
+}
+
+inline std::optional<std::string> Options_image::check() const {
+  if (m_data.size() < sizeof(Image_header)) {
+    return "truncated header";
+  }
+
+  const auto h = header();
+
+  if (h.m_magic != Image_header::magic) {
+    return "not an options image";
+  }
+  if (h.m_byte_order != Image_header::byte_order) {
+    return "written on a host of another byte order";
+  }
+  if (h.m_version != Image_header::current_version) {
+    return std::format("unsupported version {}", h.m_version);
+  }
+  if (h.m_size != m_data.size() || (m_data.size() - sizeof(Image_header)) / (sizeof(Image_entry) + sizeof(std::uint32_t)) < h.m_count) {
+    return "truncated";
+  }
+
+  auto in_bounds = [&](std::size_t offset, std::size_t size) {
+    return offset <= m_data.size() && size <= m_data.size() - offset;
+  };
+
+  auto refs_in_bounds = [&](std::size_t offset, std::size_t count) {
+    for (std::size_t i = 0; i < count; ++i) {
+      const auto ref = image_read<Image_ref>(m_data, offset + i * sizeof(Image_ref));
+
+      if (!in_bounds(ref.m_offset, ref.m_size)) {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  const auto index = sizeof(Image_header) + h.m_count * sizeof(Image_entry);
+
+  for (std::size_t id = 0; id < h.m_count; ++id) {
+    const auto e = entry(id);
+
+    if (image_read<std::uint32_t>(m_data, index + id * sizeof(std::uint32_t)) >= h.m_count) {
+      return "bad name index";
+    }
+
+    if (!in_bounds(e.m_name.m_offset, e.m_name.m_size) || e.m_type >= std::variant_size_v<Value_variant>) {
+      return std::format("bad entry {}", id);
+    }
+
+    if (e.m_value_type == Image_entry::no_value) {
+      continue;
+    }
+
+    if (e.m_value_type >= std::variant_size_v<Value_variant>) {
+      return std::format("bad entry {}", id);
+    }
+
+    const bool ok = std::visit([&](const auto& type) {
+      using T = std::decay_t<decltype(type)>;
+      using I = Image_type<T>;
+
+      if constexpr (std::same_as<I, std::string_view>) {
+        return in_bounds(e.m_payload, e.m_count);
+      } else if constexpr (Basic_value<T>) {
+        return true;
+      } else if constexpr (requires { typename T::array_type; }) {
+        using E = typename Image_type_of<typename T::array_type>::type;
+
+        if (!in_bounds(e.m_payload, std::size_t(e.m_count) * image_element_size<E>)) {
+          return false;
+        }
+        return !std::same_as<E, std::string_view> || refs_in_bounds(e.m_payload, e.m_count);
+      } else {
+        using V = typename Image_type_of<typename T::mapped_type>::type;
+
+        if (!in_bounds(e.m_payload, std::size_t(e.m_count) * (sizeof(Image_ref) + image_element_size<V>))) {
+          return false;
+        }
+        if (!refs_in_bounds(e.m_payload, e.m_count)) {
+          return false;
+        }
+        return !std::same_as<V, std::string_view> || refs_in_bounds(e.m_payload + e.m_count * sizeof(Image_ref), e.m_count);
+      }
+    }, empty_value(e.m_value_type));
+
+    if (!ok) {
+      return std::format("bad value of '{}'", name(e));
+    }
+  }
+  return std::nullopt;
+}
+
+inline std::optional<std::size_t> Options_image::find(std::string_view name) const noexcept {
+  const auto count = size();
+  const auto index = sizeof(Image_header) + count * sizeof(Image_entry);
+
+  std::size_t lo{}, hi{count};
+
+  while (lo < hi) {
+    const auto mid = lo + (hi - lo) / 2;
+    const auto id = image_read<std::uint32_t>(m_data, index + mid * sizeof(std::uint32_t));
+    const auto key = this->name(entry(id));
+
+    if (key == name) {
+      return id;
+    } else if (key < name) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return std::nullopt;
+}
+
+} // namespace cli
@@ -4,24 +4,292 @@
 
 namespace cli {
 
+/* Storage policies of Map_value. All of them iterate over (key, value)
+pairs and support find(), at(), operator[] and insert_or_assign(). Keys
+cannot be changed through an iterator. */
+
+/* Node based ordered map, the default */
+template<typename K, typename V>
+using Tree_map = std::map<K, V>;
+
+/* Tree_map in a memory resource, given to the constructor or to parse().
+Use std::pmr::string keys and values to keep the strings in it too. */
+template<typename K, typename V>
+using Pmr_map = std::pmr::map<K, V>;
+
+/* Entries in one vector sorted by key. Lookups are binary searches over
+contiguous memory, inserting in the middle moves the entries after it. */
+template<typename K, typename V>
+struct Flat_map {
+  using value_type = std::pair<K, V>;
+
+  /* Only const iterators, so keys cannot be changed in place, which would
+  break the order or the index. Values are set with operator[] and
+  insert_or_assign(). */
+  using iterator = typename std::vector<value_type>::const_iterator;
+  using const_iterator = typename std::vector<value_type>::const_iterator;
+
+  Flat_map() = default;
+
+  Flat_map(std::initializer_list<value_type> values) {
+    assign(std::vector<value_type>(values));
+  }
+
+  const_iterator begin() const { return m_entries.begin(); }
+  const_iterator end() const { return m_entries.end(); }
+  const_iterator cbegin() const { return m_entries.cbegin(); }
+  const_iterator cend() const { return m_entries.cend(); }
+
+  size_t size() const { return m_entries.size(); }
+  bool empty() const { return m_entries.empty(); }
+
+  [[nodiscard]] const_iterator find(const K& key) const {
+    auto it = std::ranges::lower_bound(m_entries, key, {}, &value_type::first);
+    return it != end() && it->first == key ? it : end();
+  }
+
+  [[nodiscard]] bool contains(const K& key) const {
+    return find(key) != end();
+  }
+
+  V& operator[](const K& key) {
+    auto it = lower_bound(key);
+
+    if (it == m_entries.end() || it->first != key) {
+      it = m_entries.emplace(it, key, V{});
+    }
+    return it->second;
+  }
+
+  const V& at(const K& key) const {
+    auto it = find(key);
+
+    if (it == end()) {
+      throw_error<std::out_of_range>("Flat_map::at");
+    }
+    return it->second;
+  }
+
+  void insert_or_assign(K key, V value) {
+    auto it = lower_bound(key);
+
+    if (it != m_entries.end() && it->first == key) {
+      it->second = std::move(value);
+    } else {
+      m_entries.emplace(it, std::move(key), std::move(value));
+    }
+  }
+
+  /* Replace the contents with entries in any order, the last of equal keys
+  wins. One sort instead of an insert per entry. */
+  void assign(std::vector<value_type>&& entries) {
+    std::ranges::stable_sort(entries, {}, &value_type::first);
+
+    m_entries.clear();
+    m_entries.reserve(entries.size());
+
+    for (auto& entry : entries) {
+      if (!m_entries.empty() && m_entries.back().first == entry.first) {
+        m_entries.back().second = std::move(entry.second);
+      } else {
+        m_entries.push_back(std::move(entry));
+      }
+    }
+  }
+
+  bool operator==(const Flat_map& other) const = default;
+
+private:
+  [[nodiscard]] typename std::vector<value_type>::iterator lower_bound(const K& key) {
+    return std::ranges::lower_bound(m_entries, key, {}, &value_type::first);
+  }
+
+  std::vector<value_type> m_entries;
+};
+
+/* Open addressing hash map. The entries are kept in insertion order in one
+vector, a power of two table of slots with linear probing indexes them.
+Each slot keeps part of the hash so that most mismatches are rejected
+without comparing keys, and growing does not rehash the keys. */
 template<typename K, typename V>
-requires std::convertible_to<K, std::string>
+struct Hash_map {
+  using value_type = std::pair<K, V>;
+
+  /* Only const iterators, like Flat_map */
+  using iterator = typename std::vector<value_type>::const_iterator;
+  using const_iterator = typename std::vector<value_type>::const_iterator;
+
+  Hash_map() = default;
+
+  Hash_map(std::initializer_list<value_type> values) {
+    assign(std::vector<value_type>(values));
+  }
+
+  const_iterator begin() const { return m_entries.begin(); }
+  const_iterator end() const { return m_entries.end(); }
+  const_iterator cbegin() const { return m_entries.cbegin(); }
+  const_iterator cend() const { return m_entries.cend(); }
+
+  size_t size() const { return m_entries.size(); }
+  bool empty() const { return m_entries.empty(); }
+
+  [[nodiscard]] const_iterator find(const K& key) const {
+    const auto [slot, hash] = probe(key);
+    return m_slots.empty() || m_slots[slot].m_index == 0 ? end() : begin() + (m_slots[slot].m_index - 1);
+  }
+
+  [[nodiscard]] bool contains(const K& key) const {
+    return find(key) != end();
+  }
+
+  V& operator[](const K& key) {
+    return emplace(key, V{}, false);
+  }
+
+  const V& at(const K& key) const {
+    auto it = find(key);
+
+    if (it == end()) {
+      throw_error<std::out_of_range>("Hash_map::at");
+    }
+    return it->second;
+  }
+
+  void insert_or_assign(K key, V value) {
+    emplace(std::move(key), std::move(value), true);
+  }
+
+  /* Replace the contents, the last of equal keys wins */
+  void assign(std::vector<value_type>&& entries) {
+    m_entries.clear();
+    m_slots.clear();
+    reserve(entries.size());
+
+    for (auto& [key, value] : entries) {
+      emplace(std::move(key), std::move(value), true);
+    }
+  }
+
+  void reserve(std::size_t n) {
+    if (n * 2 > m_slots.size()) {
+      rehash(std::bit_ceil(std::max<std::size_t>(n * 2, 8)));
+    }
+    m_entries.reserve(n);
+  }
+
+  /* Equal entries, in any order */
+  bool operator==(const Hash_map& other) const {
+    return size() == other.size() && std::ranges::all_of(m_entries, [&](const auto& entry) {
+      auto it = other.find(entry.first);
+      return it != other.end() && it->second == entry.second;
+    });
+  }
+
+private:
+  struct Slot {
+    /* Entry index + 1, 0 for a free slot */
+    std::uint32_t m_index{};
+    std::uint32_t m_hash{};
+  };
+
+  /* Slot holding key, or the free slot where it belongs */
+  [[nodiscard]] std::pair<std::size_t, std::uint32_t> probe(const K& key) const {
+    const auto hash = std::uint32_t(std::hash<K>{}(key));
+
+    if (m_slots.empty()) {
+      return {0, hash};
+    }
+
+    const auto mask = m_slots.size() - 1;
+
+    for (auto i = std::size_t(hash) & mask;; i = (i + 1) & mask) {
+      const auto& slot = m_slots[i];
+
+      if (slot.m_index == 0 || (slot.m_hash == hash && m_entries[slot.m_index - 1].first == key)) {
+        return {i, hash};
+      }
+    }
+  }
+
+  V& emplace(K key, V value, bool assign) {
+    /* At most half full */
+    if ((m_entries.size() + 1) * 2 > m_slots.size()) {
+      rehash(std::max<std::size_t>(m_slots.size() * 2, 8));
+    }
+
+    const auto [i, hash] = probe(key);
+    auto& slot = m_slots[i];
+
+    if (slot.m_index != 0) {
+      auto& entry = m_entries[slot.m_index - 1].second;
+
+      if (assign) {
+        entry = std::move(value);
+      }
+      return entry;
+    }
+
+    m_entries.emplace_back(std::move(key), std::move(value));
+    slot = Slot{std::uint32_t(m_entries.size()), hash};
+
+    return m_entries.back().second;
+  }
+
+  void rehash(std::size_t capacity) {
+    std::vector<Slot> slots(capacity);
+    const auto mask = capacity - 1;
+
+    for (const auto& slot : m_slots) {
+      if (slot.m_index != 0) {
+        auto i = std::size_t(slot.m_hash) & mask;
+
+        while (slots[i].m_index != 0) {
+          i = (i + 1) & mask;
+        }
+        slots[i] = slot;
+      }
+    }
+    m_slots = std::move(slots);
+  }
+
+  std::vector<value_type> m_entries;
+  std::vector<Slot> m_slots;
+};
+
+template<typename K, typename V, template<typename, typename> typename Storage = Tree_map>
+requires std::constructible_from<K, std::string_view>
 struct Map_value {
+  using storage_type = Storage<K, V>;
   using key_type = K;
   using mapped_type = V;
-  using value_type = std::pair<const K, V>;
-  using iterator = typename std::map<K, V>::iterator;
-  using const_iterator = typename std::map<K, V>::const_iterator;
+  using value_type = typename storage_type::value_type;
+  using iterator = typename storage_type::iterator;
+  using const_iterator = typename storage_type::const_iterator;
 
   /* Constructors */
   Map_value() = default;
 
-  explicit Map_value(const std::map<K, V>& values)
+  explicit Map_value(const storage_type& values)
     : m_values(values) {}
 
-  explicit Map_value(std::map<K, V>&& values)
+  explicit Map_value(storage_type&& values)
     : m_values(std::move(values)) {}
 
+  /* Empty map of allocator aware storage, e.g. Pmr_map */
+  template<typename Allocator>
+  requires std::uses_allocator_v<storage_type, Allocator>
+  explicit Map_value(const Allocator& alloc)
+    : m_values(alloc) {}
+
+  /* Copy of a map with another storage policy, e.g. a flat copy of an
+  option value for a map that is read a lot */
+  template<template<typename, typename> typename Other>
+  requires (!std::same_as<Storage<K, V>, Other<K, V>>)
+  explicit Map_value(const Map_value<K, V, Other>& other) {
+    std::vector<std::pair<K, V>> entries(other.begin(), other.end());
+    assign(std::move(entries));
+  }
+
   iterator begin() { return m_values.begin(); }
   iterator end() { return m_values.end(); }
   const_iterator begin() const { return m_values.begin(); }
@@ -29,54 +297,30 @@ struct Map_value {
   const_iterator cbegin() const { return m_values.cbegin(); }
   const_iterator cend() const { return m_values.cend(); }
 
-  const std::map<K, V>& values() const { return m_values; }
-  std::map<K, V>& values() { return m_values; }
-  
+  const storage_type& values() const { return m_values; }
+  storage_type& values() { return m_values; }
+
   size_t size() const { return m_values.size(); }
   bool empty() const { return m_values.empty(); }
-  
+
   V& operator[](const K& key) { return m_values[key]; }
   const V& at(const K& key) const { return m_values.at(key); }
 
-  bool operator==(const Map_value& other) const = default;
-
-  static std::optional<Map_value<K, V>> parse(const std::string& input) {
-    try {
-      std::string pair;
-      Map_value<K, V> result;
-      std::istringstream iss(input);
-
-      while (std::getline(iss, pair, ',')) {
-        auto sep_pos = pair.find('=');
+  void insert_or_assign(K key, V value) {
+    m_values.insert_or_assign(std::move(key), std::move(value));
+  }
 
-        if (sep_pos == std::string::npos) {
-          continue;
-        }
+  bool operator==(const Map_value& other) const = default;
 
-        auto key = pair.substr(0, sep_pos);
-        auto value = pair.substr(sep_pos + 1);
-
-        /* Trim whitespace */
-        key.erase(0, key.find_first_not_of(" \t"));
-        key.erase(key.find_last_not_of(" \t") + 1);
-        value.erase(0, value.find_first_not_of(" \t"));
-        value.erase(value.find_last_not_of(" \t") + 1);
-
-        if constexpr (std::is_same_v<V, int>) {
-          result.m_values[key] = std::stoi(value);
-        } else if constexpr (std::is_same_v<V, double>) {
-          result.m_values[key] = std::stod(value);
-        } else if constexpr (std::is_same_v<V, bool>) {
-          result.m_values[key] = is_true(value);
-        } else if constexpr (std::is_same_v<V, std::string>) {
-          result.m_values[key] = value;
-        }
-      }
+  static std::optional<Map_value> parse(std::string_view input) {
+    return parse_into(Map_value(), input);
+  }
 
-      return result;
-    } catch (...) {
-      return std::nullopt;
-    }
+  /* Parse into allocator aware storage using alloc */
+  template<typename Allocator>
+  requires std::uses_allocator_v<storage_type, Allocator>
+  static std::optional<Map_value> parse(std::string_view input, const Allocator& alloc) {
+    return parse_into(Map_value(alloc), input);
   }
 
   [[nodiscard]] std::string to_string() const {
@@ -94,7 +338,60 @@ struct Map_value {
   }
 
 private:
-  std::map<K, V> m_values;
+  static std::optional<Map_value> parse_into(Map_value result, std::string_view input) {
+    Tokenizer pairs(input);
+
+    /* Policies that can build from a batch get all entries at once */
+    constexpr bool batch = requires(storage_type& s, std::vector<std::pair<K, V>>&& e) { s.assign(std::move(e)); };
+    std::vector<std::pair<K, V>> entries;
+
+    if constexpr (batch) {
+      entries.reserve(pairs.count());
+    }
+
+    while (auto pair = pairs.next()) {
+      auto sep_pos = find_byte(*pair, '=');
+
+      if (sep_pos == std::string_view::npos) {
+        continue;
+      }
+
+      auto value = convert_token<V>(trim(pair->substr(sep_pos + 1)));
+
+      if (!value) {
+        return std::nullopt;
+      }
+
+      const auto key = trim(pair->substr(0, sep_pos));
+
+      if constexpr (batch) {
+        entries.emplace_back(K(key), std::move(*value));
+      } else if constexpr (requires { result.m_values.get_allocator(); }) {
+        /* The key is built with the allocator of the storage, so that
+        storage in a memory resource moves it into the node */
+        result.m_values.insert_or_assign(std::make_obj_using_allocator<K>(result.m_values.get_allocator(), key), std::move(*value));
+      } else {
+        result.m_values.insert_or_assign(K(key), std::move(*value));
+      }
+    }
+
+    if constexpr (batch) {
+      result.m_values.assign(std::move(entries));
+    }
+    return result;
+  }
+
+  void assign(std::vector<std::pair<K, V>>&& entries) {
+    if constexpr (requires { m_values.assign(std::move(entries)); }) {
+      m_values.assign(std::move(entries));
+    } else {
+      for (auto& [key, value] : entries) {
+        m_values.insert_or_assign(std::move(key), std::move(value));
+      }
+    }
+  }
+
+  storage_type m_values;
 };
 
-} // namespace cli
\ No newline at end of file
+} // namespace cli
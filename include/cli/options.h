@@ -2,11 +2,13 @@
 
 #include "cli/cli.h"
 
+#include <unistd.h>
+
 namespace cli {
 
 /* Value type concepts */
 template<typename T>
-concept Basic_value = std::same_as<T, bool> || std::same_as<T, int> || std::same_as<T, double> || std::same_as<T, std::string>;
+concept Basic_value = std::same_as<T, bool> || std::same_as<T, int> || std::same_as<T, double> || std::same_as<T, std::string> || std::same_as<T, std::string_view>;
 
 template<typename T>
 concept Option_value = Basic_value<T> ||
@@ -21,6 +23,8 @@ using Value_variant = std::variant<
     int,
     double,
     std::string,
+    /* Borrowed string, points into argv or the environment */
+    std::string_view,
     Array_value<int>,
     Array_value<bool>,
     Array_value<double>,
@@ -51,276 +55,1521 @@ struct Option_descriptor {
   std::optional<std::string> m_env_var{};
 };
 
+/* Option value in command line syntax, e.g. {"limits", "cpu=4,memory=1024"} */
+struct Assignment {
+  /* Long name, or short name of an option without one */
+  std::string_view m_name{};
+  std::string_view m_value{};
+};
+
+/* Where an option value comes from, each source overrides the ones before */
+enum class Value_source : std::uint8_t {
+  defaults,
+  file,
+  env,
+  argv
+};
+
+inline constexpr std::size_t value_source_count = 4;
+
+/* Values set by one source, only the options it overrides keyed by option
+id. Layers are shared by derived Options and by snapshots and copied before
+a write while shared. Node based so that pointers to values stay valid. */
+using Value_layer = std::pmr::unordered_map<std::size_t, Value_variant>;
+
+/* Summary of a successful try_parse() */
+struct Parse_result {
+  /* Number of options set from the command line */
+  std::size_t m_options_set{};
+
+  /* Number of positional arguments seen */
+  std::size_t m_positional_count{};
+};
+
+/* Typed index of an option returned by add_option(), reading through a handle
+is a plain array access with no name lookup. */
+template<Option_value T>
+struct Option_handle {
+  using value_type = T;
+
+  static constexpr std::size_t invalid_id = std::numeric_limits<std::size_t>::max();
+
+  [[nodiscard]] constexpr bool valid() const noexcept {
+    return m_id != invalid_id;
+  }
+
+  constexpr bool operator==(const Option_handle& other) const = default;
+
+  /* Dense index into the option value table */
+  std::size_t m_id{invalid_id};
+};
+
+template<typename T, std::size_t I = 0>
+[[nodiscard]] consteval std::size_t value_type_index() {
+  static_assert(I < std::variant_size_v<Value_variant>, "Not a Value_variant alternative");
+
+  if constexpr (std::same_as<T, std::variant_alternative_t<I, Value_variant>>) {
+    return I;
+  } else {
+    return value_type_index<T, I + 1>();
+  }
+}
+
+/* Option_spec::m_type of an option holding a T */
+template<Option_value T>
+inline constexpr std::size_t type_of = value_type_index<T>();
+
+/* Empty value of a Value_variant alternative, used as the type of schema options */
+[[nodiscard]] inline const Value_variant& empty_value(std::size_t type) {
+  static const auto values = []<std::size_t... I>(std::index_sequence<I...>) {
+    return std::array<Value_variant, sizeof...(I)>{Value_variant(std::in_place_index<I>)...};
+  }(std::make_index_sequence<std::variant_size_v<Value_variant>>{});
+
+  return values[type];
+}
+
+/* Handle of a schema option, the name and type are checked at compile time */
+template<Option_value T, std::size_t N>
+[[nodiscard]] consteval Option_handle<T> make_handle(const Schema<N>& schema, std::string_view name) {
+  const auto id = schema.find(name);
+
+  if (!id || schema.specs()[*id].m_type != type_of<T>) {
+    schema_error("Unknown option or type mismatch");
+  }
+  return Option_handle<T>{*id};
+}
+
+using Validation_callback = std::function<bool(const Value_variant&)>;
+
+/* Validators by the name the option value is stored under */
+using Validator_map = Pmr_string_map<Validation_callback>;
+
+/* Run the validator of the option stored under name, if it has one */
+[[nodiscard]] inline bool validate_value(const Validator_map& validators, std::string_view name, const Value_variant& value) {
+  if (auto it = validators.find(name); it != validators.end()) {
+#if defined(__cpp_exceptions)
+    /* A throwing validator, e.g. std::get on the wrong type, rejects the value */
+    try {
+      return it->second(value);
+    } catch (const std::exception&) {
+      return false;
+    }
+#else
+    return it->second(value);
+#endif
+  }
+  return true;
+}
+
+/* Option tables of dynamically added options. Shared by derived Options and
+snapshots, and copied before a change while shared. */
+struct Option_table {
+  using allocator_type = std::pmr::polymorphic_allocator<>;
+
+  Option_table() = default;
+
+  explicit Option_table(const allocator_type& alloc)
+    : m_descriptors(alloc), m_short_names(alloc), m_long_names(alloc), m_validators(alloc), m_types(alloc), m_required(alloc) {}
+
+  Option_table(const Option_table& other, const allocator_type& alloc)
+    : m_descriptors(other.m_descriptors, alloc),
+      m_short_names(other.m_short_names, alloc),
+      m_long_names(other.m_long_names, alloc),
+      m_validators(other.m_validators, alloc),
+      m_types(other.m_types, alloc),
+      m_required(other.m_required, alloc) {}
+
+  /* Descriptor of each option by value index, the only copy */
+  std::pmr::vector<Option_descriptor> m_descriptors;
+
+  /* Option names to value index */
+  Pmr_string_map<std::size_t> m_short_names;
+  Pmr_string_map<std::size_t> m_long_names;
+
+  Validator_map m_validators;
+
+  /* Value_variant alternative of each option by value index */
+  std::pmr::vector<std::uint8_t> m_types;
+
+  /* Required options, checked after every parse without name lookups */
+  std::pmr::vector<std::size_t> m_required;
+};
+
+/* Name under which the value of an option is stored */
+[[nodiscard]] inline const std::string& value_key(const Option_descriptor& desc) noexcept {
+  return desc.m_long_name.empty() ? desc.m_short_name : desc.m_long_name;
+}
+
+/* Value index of an option by the name its value is stored under, looked
+up in the schema if there is one, else in the table */
+[[nodiscard]] inline std::optional<std::size_t> find_value_id(const Schema_view& schema, const Option_table& table, std::string_view name) {
+  if (!schema.empty()) {
+    if (auto id = schema.find(name, false)) {
+      return id;
+    }
+    return schema.find(name, true);
+  }
+
+  if (auto it = table.m_long_names.find(name); it != table.m_long_names.end()) {
+    return it->second;
+  }
+
+  /* Short names only store the values of options without a long name */
+  if (auto it = table.m_short_names.find(name); it != table.m_short_names.end() && table.m_descriptors[it->second].m_long_name.empty()) {
+    return it->second;
+  }
+  return std::nullopt;
+}
+
+/* Table of Options without dynamically added options, shared so that a
+derived or schema Options does not allocate one */
+[[nodiscard]] inline const std::shared_ptr<Option_table>& empty_option_table() {
+  static const auto table = std::make_shared<Option_table>();
+  return table;
+}
+
+/* Value_variant alternative of an option */
+[[nodiscard]] inline std::size_t option_type(const Schema_view& schema, const Option_table& table, std::size_t id) {
+  return schema.empty() ? table.m_types[id] : schema.m_specs[id].m_type;
+}
+
+/* Whether values of type are collections, whose conversion can be deferred */
+[[nodiscard]] inline bool is_collection(const Value_variant& type) noexcept {
+  return std::visit([](const auto& v) {
+    return !Basic_value<std::decay_t<decltype(v)>>;
+  }, type);
+}
+
+/* Collection value kept as text until it is first read. Shared by snapshots
+and derived Options, the conversion runs once even if several threads read
+the value at the same time. */
+struct Lazy_value {
+  Lazy_value(std::string key, std::string_view text, std::size_t type)
+    : m_key(std::move(key)), m_text(text), m_type(type) {}
+
+  /* Converted and validated value, nullptr if the text is not valid */
+  [[nodiscard]] const Value_variant* get(const Validator_map& validators) const;
+
+  /* Why the text is not valid, std::nullopt if it is. Converts the text. */
+  [[nodiscard]] std::optional<Diagnostic_code> error(const Validator_map& validators) const {
+    return get(validators) == nullptr ? m_error : std::nullopt;
+  }
+
+  /* Name the option value is stored under */
+  std::string m_key;
+  std::string_view m_text;
+  std::size_t m_type{};
+
+private:
+  mutable std::once_flag m_once;
+  mutable std::optional<Value_variant> m_value;
+  mutable std::optional<Diagnostic_code> m_error;
+};
+
+/* Current option values in two dense columns indexed by option id: a type
+byte, and an 8 byte cell that holds bool, int and double values inline and
+points to the value in its layer for strings and collections. Reading or
+scanning scalars touches nothing else, 100 options fit in 15 cache lines. */
+struct Value_table {
+  using allocator_type = std::pmr::polymorphic_allocator<>;
+
+  /* Type byte of an option without a value */
+  static constexpr std::uint8_t no_value = 0xFF;
+
+  Value_table() = default;
+
+  explicit Value_table(const allocator_type& alloc)
+    : m_types(alloc), m_cells(alloc), m_lazy(alloc) {}
+
+  Value_table(const Value_table& other, const allocator_type& alloc)
+    : m_types(other.m_types, alloc), m_cells(other.m_cells, alloc), m_lazy(other.m_lazy, alloc) {}
+
+  Value_table(const Value_table&) = default;
+  Value_table(Value_table&&) noexcept = default;
+  Value_table& operator=(const Value_table&) = default;
+  Value_table& operator=(Value_table&&) = default;
+
+  union Cell {
+    bool m_bool;
+    int m_int;
+    double m_double;
+    const Value_variant* m_ref;
+  };
+
+  [[nodiscard]] std::size_t size() const noexcept {
+    return m_types.size();
+  }
+
+  [[nodiscard]] bool has_value(std::size_t id) const noexcept {
+    return m_types[id] != no_value;
+  }
+
+  /* Same as get(), a lazy value is converted first and has no value if its
+  text is not valid */
+  [[nodiscard]] bool has_value(std::size_t id, const Validator_map& validators) const {
+    if (id < m_lazy.size() && m_lazy[id]) {
+      return m_lazy[id]->get(validators) != nullptr;
+    }
+    return has_value(id);
+  }
+
+  void resize(std::size_t n) {
+    m_types.resize(n, no_value);
+    m_cells.resize(n);
+  }
+
+  void clear() noexcept {
+    m_types.clear();
+    m_cells.clear();
+    m_lazy.clear();
+  }
+
+  /* Make value, which must outlive the table entry, the value of id */
+  void set(std::size_t id, const Value_variant* value) noexcept {
+    if (value == nullptr) {
+      m_types[id] = no_value;
+      return;
+    }
+
+    m_types[id] = std::uint8_t(value->index());
+
+    std::visit([&](const auto& v) {
+      using T = std::decay_t<decltype(v)>;
+
+      if constexpr (std::same_as<T, bool>) {
+        m_cells[id].m_bool = v;
+      } else if constexpr (std::same_as<T, int>) {
+        m_cells[id].m_int = v;
+      } else if constexpr (std::same_as<T, double>) {
+        m_cells[id].m_double = v;
+      } else {
+        m_cells[id].m_ref = value;
+      }
+    }, *value);
+  }
+
+  /* Value of id if it is a T, converting a lazy value first */
+  template<Option_value T>
+  [[nodiscard]] const T* get(std::size_t id, const Validator_map& validators) const noexcept {
+    if (id >= m_types.size() || m_types[id] != type_of<T>) {
+      return nullptr;
+    }
+
+    if constexpr (std::same_as<T, bool>) {
+      return &m_cells[id].m_bool;
+    } else if constexpr (std::same_as<T, int>) {
+      return &m_cells[id].m_int;
+    } else if constexpr (std::same_as<T, double>) {
+      return &m_cells[id].m_double;
+    } else {
+      const auto* value = m_cells[id].m_ref;
+
+      if constexpr (!Basic_value<T>) {
+        if (id < m_lazy.size() && m_lazy[id]) {
+          value = m_lazy[id]->get(validators);
+        }
+      }
+      return value == nullptr ? nullptr : std::get_if<T>(value);
+    }
+  }
+
+  std::pmr::vector<std::uint8_t> m_types;
+  std::pmr::vector<Cell> m_cells;
+
+  /* Collection values given on the command line and not converted yet,
+  sized on demand. Set while the value in the argv layer is a placeholder
+  for the text. */
+  std::pmr::vector<std::shared_ptr<const Lazy_value>> m_lazy;
+};
+
+struct Options_snapshot;
+
+template<std::size_t Capacity>
+struct Overlay;
+
 struct Options {
   Options() = default;
   ~Options() = default;
 
+  /* Options whose option table, value layers and value table are allocated
+  from resource, e.g. a std::pmr::monotonic_buffer_resource that is freed in
+  one step with everything parsed into it. The resource must outlive the
+  options, their snapshots and the Options derived from them. */
+  explicit Options(std::pmr::memory_resource* resource)
+    : m_resource(resource), m_values(Value_table::allocator_type(resource)) {}
+
+  /* Options of a compile time schema. Names are resolved with the schema's
+  perfect hash, the schema must outlive the options. */
+  template<std::size_t N>
+  explicit Options(const Schema<N>& schema, std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+  [[nodiscard]] std::pmr::memory_resource* resource() const noexcept {
+    return m_resource;
+  }
+
   /* Disable copy operations due to internal state */
   Options(const Options&) = delete;
   Options& operator=(const Options&) = delete;
 
-  /* Move operations */
-  Options(Options&&) noexcept = default;
-  Options& operator=(Options&&) noexcept = default;
+  /* Move operations */
+  Options(Options&&) noexcept = default;
+  Options& operator=(Options&&) noexcept = default;
+
+  /* Add an option with type deduction, returns a handle for fast access.
+  The descriptor is stored once, pass it as an rvalue to move a large
+  default value in instead of copying it. */
+  template<Option_value T>
+  inline Option_handle<T> add_option(Option_descriptor&& desc);
+
+  template<Option_value T>
+  inline Option_handle<T> add_option(const Option_descriptor& desc) {
+    return add_option<T>(Option_descriptor(desc));
+  }
+
+  /* Parse command line arguments, diagnostics are logged */
+  [[nodiscard]] inline bool parse(int argc, char* argv[]);
+
+  /* Parse command line arguments without logging or throwing, all problems
+  found are returned as diagnostics. */
+  [[nodiscard]] inline std::expected<Parse_result, std::vector<Diagnostic>> try_parse(int argc, char* argv[]);
+
+  /* Same as above for arguments without the program name. Values of
+  std::string_view options point into the arguments. */
+  [[nodiscard]] inline std::expected<Parse_result, std::vector<Diagnostic>> try_parse(std::span<const std::string_view> args);
+
+  /* Parse many command lines, each without the program name, against these
+  options on up to threads threads (0 for one per core). Every entry is
+  parsed into Options derived from these, so they share the option table
+  and values and hold only their own. Results are in input order. The
+  entries allocate from resource, which must be thread safe for more than
+  one thread, e.g. std::pmr::synchronized_pool_resource. Without one they
+  use std::pmr::get_default_resource(), not the resource of these options. */
+  [[nodiscard]] inline std::vector<std::expected<Options, std::vector<Diagnostic>>> parse_batch(std::span<const std::span<const std::string_view>> batch, std::size_t threads = 0, std::pmr::memory_resource* resource = nullptr) const;
+
+  /* Maximum nesting of @path arguments inside response files */
+  static constexpr int max_response_file_depth = 8;
+
+  /* Expand @path arguments with the contents of the file at path. The file
+  is memory mapped and its arguments are views into the mapping, which the
+  options keep alive until reset(Value_source::argv) or clear(). Parsing an
+  unchanged file again reuses its mapping. */
+  inline void enable_response_files(bool enable = true) {
+    m_response_files_enabled = enable;
+  }
+
+  /* Get option value with type checking */
+  template<Option_value T>
+  [[nodiscard]] std::optional<T> get(std::string_view name) const;
+
+  /* Get option value by handle, nullptr if the option has no value */
+  template<Option_value T>
+  [[nodiscard]] const T* operator[](Option_handle<T> handle) const noexcept {
+    return m_values.template get<T>(handle.m_id, m_table->m_validators);
+  }
+
+  /* Keep collection values given on the command line as text and convert
+  them when they are first read, so that long lists that a run never looks
+  at cost nothing. Invalid values are then reported as missing values, or
+  by validate_all(). Options with a change callback are always converted
+  right away. The arguments must outlive the options, like for
+  std::string_view values. */
+  inline void enable_lazy_collections(bool enable = true) {
+    m_lazy_collections = enable;
+  }
+
+  /* Convert and validate all values kept as text, returns the problems */
+  [[nodiscard]] inline std::expected<void, std::vector<Diagnostic>> validate_all() const;
+
+  /* Call callback with the value of the option every time it is set, and
+  right away if it already has one. */
+  template<Option_value T>
+  inline void on_change(Option_handle<T> handle, std::type_identity_t<std::function<void(const T&)>> callback);
+
+  /* Check if option exists */
+  [[nodiscard]] inline bool has_value(std::string_view name) const {
+    auto id = find_value_id(name);
+    return id && m_values.has_value(*id, m_table->m_validators);
+  }
+
+  /* Do not look up m_env_var in add_option(), for programs that read the
+  whole environment with import_env() once all options are added */
+  inline void defer_env(bool defer = true) {
+    m_env_deferred = defer;
+  }
+
+  /* Set options from the environment in one pass over environ: options with
+  an m_env_var and, if prefix is not empty, options whose long name upper
+  cased with '-' as '_' follows prefix (APP_MAX_CONNECTIONS for prefix
+  "APP_" and --max-connections). An explicit m_env_var wins over the prefix
+  name. All values are applied or none, returns the number set. */
+  [[nodiscard]] inline std::expected<std::size_t, std::vector<Diagnostic>> import_env(std::string_view prefix = {});
+
+  /* Source of the current value of an option, std::nullopt if it has none */
+  [[nodiscard]] inline std::optional<Value_source> source(std::string_view name) const;
+
+  /* Drop every value set by source, the options fall back to the sources
+  below it */
+  inline void reset(Value_source source);
+
+  /* Drop the value source set for the option name, by long or short name.
+  Returns whether there was one. */
+  inline bool reset(std::string_view name, Value_source source);
+
+  /* Options with the same option table whose values start out as the
+  values of these. The value layers are shared until one side writes to
+  them, so a derived Options costs a pointer per option plus its own
+  overrides. Change callbacks and positional arguments are not inherited.
+  The derived options allocate from resource, by default the resource of
+  these. */
+  [[nodiscard]] inline Options derive(std::pmr::memory_resource* resource = nullptr) const;
+
+  /* Set several options from text, all or nothing: every value is converted
+  and validated before any is stored. Returns the number of options set. */
+  [[nodiscard]] inline std::expected<std::size_t, std::vector<Diagnostic>> set(std::span<const Assignment> assignments, Value_source source = Value_source::file);
+
+  /* Keep storage alive for as long as std::string_view values, or snapshots
+  of them, may point into it */
+  inline void retain(std::shared_ptr<const void> storage) {
+    m_storage.push_back(std::move(storage));
+  }
+
+  /* Retain storage in place of replaced, once no value points into it.
+  Snapshots taken before keep their reference to replaced. */
+  inline void retain(std::shared_ptr<const void> storage, const void* replaced) {
+    if (auto it = std::ranges::find(m_storage, replaced, &std::shared_ptr<const void>::get); it != m_storage.end()) {
+      *it = std::move(storage);
+    } else {
+      m_storage.push_back(std::move(storage));
+    }
+  }
+
+  /* Stop retaining storage, once no value points into it. Snapshots taken
+  before keep their reference. */
+  inline void release(const void* storage) {
+    std::erase_if(m_storage, [&](const auto& retained) {
+      return retained.get() == storage;
+    });
+  }
+
+  /* Number of buffers retained for std::string_view values */
+  [[nodiscard]] std::size_t retained() const noexcept {
+    return m_storage.size();
+  }
+
+  /* Immutable copy of the current values that can be read from any thread */
+  [[nodiscard]] inline std::shared_ptr<const Options_snapshot> freeze() const;
+
+  /* Print help message */
+  inline void print_help(std::string_view program_name) const;
+
+  /* Write the help message to out in one write() */
+  inline void print_help(std::ostream& out, std::string_view program_name) const;
+
+  /* Write the help message to fd in one write(). Returns errno on failure. */
+  [[nodiscard]] inline std::expected<void, int> print_help(int fd, std::string_view program_name) const;
+
+  /* The option lines of the help message, rendered on first use and kept
+  until an option is added or the options are cleared */
+  [[nodiscard]] inline const std::string& help_text() const;
+
+  /* Clear all options, values and settings, the options then behave like
+  new Options with the same memory resource */
+  inline void clear();
+
+  /* Validation callback type */
+  using Validation_callback = cli::Validation_callback;
+
+  /* Add validation for an option */
+  inline void add_validation(std::string_view name, Validation_callback callback);
+
+  /* Check if value is a boolean */
+  [[nodiscard]] static inline bool is_boolean(std::string_view value) {
+    return value == "true" || value == "false" || value == "1" || value == "0" || value == "yes" || value == "no" || value == "on" || value == "off";
+  }
+
+  /* Get all positional arguments, empty if they go to a positional callback */
+  [[nodiscard]] inline const std::vector<std::string>& positional_args() const {
+    return m_positional_args;
+  }
+
+  /* Positional argument callback, the view is only valid during the call */
+  using Positional_callback = std::function<void(std::string_view)>;
+
+  /* Pass positional arguments to callback as they are scanned instead of
+  collecting them in positional_args() */
+  inline void on_positional(Positional_callback callback) {
+    m_positional_callback = std::move(callback);
+  }
+
+  /* Read positional arguments separated by delimiter from fd, '\0' for
+  find -print0 style input or '\n' for one per line. Returns the number of
+  arguments read. */
+  [[nodiscard]] inline std::expected<std::size_t, Diagnostic> read_positionals(int fd, char delimiter = '\0');
+
+private:
+  /* Option resolved from a command line name */
+  struct Option_ref {
+    std::size_t m_id{};
+
+    /* Name under which the value is stored */
+    std::string_view m_key{};
+
+    /* Value of the option type */
+    const Value_variant* m_type{};
+  };
+
+  [[nodiscard]] inline std::optional<Option_ref> resolve(std::string_view name, bool is_short) const;
+
+  /* Value index of an option by its stored name */
+  [[nodiscard]] inline std::optional<std::size_t> find_value_id(std::string_view name) const;
+
+  [[nodiscard]] inline bool is_option(std::string_view arg) const;
+
+  inline void add_positional(std::string_view arg) {
+    if (m_positional_callback) {
+      m_positional_callback(arg);
+    } else {
+      m_positional_args.emplace_back(arg);
+    }
+  }
+
+  /* Parse a random access range of arguments, without the program name */
+  template<typename Args>
+  [[nodiscard]] inline std::expected<Parse_result, std::vector<Diagnostic>> parse_args(const Args& args);
+
+  /* Append the arguments, expanding @path arguments recursively */
+  template<typename Args>
+  inline void expand_args(const Args& args, int depth, std::vector<std::string_view>& out, std::vector<Diagnostic>& diagnostics);
+
+  /* Mapping of a response file, the one of an earlier parse if the file has
+  not changed since. nullptr with errno set on failure. */
+  [[nodiscard]] inline std::shared_ptr<const Mapped_file> map_response_file(const std::string& path);
+
+  /* Returns the failure, std::nullopt if the option was set or ignored */
+  [[nodiscard]] inline std::optional<Diagnostic_code> handle_option(std::string_view name, std::string_view value, bool is_short = false);
+
+  template<std::size_t Capacity>
+  friend struct Overlay;
+
+  friend struct Lazy_value;
+
+  friend struct Options_image;
+
+  friend struct Completion_index;
+
+  /* Convert a raw value to the type of the option default */
+  [[nodiscard]] static inline std::optional<Value_variant> parse_value(const Value_variant& type, std::string_view value);
+
+  inline void handle_value(std::size_t id, std::string_view name, const Value_variant& value, Value_source source = Value_source::argv);
+
+  /* Set the value of an option in the layer of source and notify its change
+  callback if that makes it the current value */
+  inline void store(std::size_t id, Value_variant&& value, Value_source source = Value_source::argv);
+
+  /* Keep the text of a collection value for lazy conversion */
+  inline void store_lazy(const Option_ref& option, std::string_view text);
+
+  /* Current value of an option as a variant, converting a lazy value. Looked
+  up in the layers, for the rare callers that need the variant. */
+  [[nodiscard]] inline const Value_variant* current_value(std::size_t id) const;
+
+  /* Layer of source, created if empty and copied first if shared */
+  [[nodiscard]] inline Value_layer& writable_layer(Value_source source);
+
+  /* Point the option at its value in the top-most layer that has one */
+  inline void resolve_value(std::size_t id);
+
+  /* The returned view points into the environment, it is not copied */
+  [[nodiscard]] inline std::string_view get_env_value(const std::string& name) const {
+    if (const char* env = std::getenv(name.c_str())) {
+      return env;
+    } else {
+      return {};
+    }
+  }
+
+  [[nodiscard]] inline bool validate_option(std::string_view name, const Value_variant& value) const {
+    return validate_value(m_table->m_validators, name, value);
+  }
+
+  /* Option table, copied first if shared */
+  [[nodiscard]] inline Option_table& writable_table() {
+    const std::pmr::polymorphic_allocator<> alloc(m_resource);
+
+    if (!m_table) {
+      m_table = std::allocate_shared<Option_table>(alloc);
+    } else if (m_table.use_count() > 1) {
+      /* Also the case for the empty table */
+      m_table = std::allocate_shared<Option_table>(alloc, *m_table);
+    }
+    m_help.reset();
+    m_help_message.reset();
+    return *m_table;
+  }
+
+  void apply_default_values();
+
+private:
+  /* Declared first, the members below are allocated from it */
+  std::pmr::memory_resource* m_resource{std::pmr::get_default_resource()};
+
+  bool m_allow_unrecognized{};
+  bool m_env_deferred{};
+  std::vector<std::string> m_positional_args;
+  Positional_callback m_positional_callback;
+
+  /* Compile time schema, replaces the option table when set */
+  Schema_view m_schema{};
+  std::shared_ptr<Option_table> m_table{empty_option_table()};
+
+  /* Value layers indexed by Value_source, nullptr while empty */
+  std::array<std::shared_ptr<Value_layer>, value_source_count> m_layers;
+
+  /* Current value of each option indexed by Option_handle::m_id, the value
+  in the top-most layer that sets the option */
+  Value_table m_values{Value_table::allocator_type(m_resource)};
+
+  bool m_response_files_enabled{};
+
+  /* Response file mapped by a parse, identified by its inode and
+  modification time */
+  struct Response_file {
+    dev_t m_device{};
+    ino_t m_inode{};
+    off_t m_size{};
+    timespec m_modified{};
+
+    /* Also in m_storage, until the argv layer is reset */
+    std::shared_ptr<const Mapped_file> m_file;
+  };
+
+  /* Response files the parsed arguments point into */
+  std::vector<Response_file> m_response_files;
+
+  /* Buffers that std::string_view values may point into */
+  std::vector<std::shared_ptr<const void>> m_storage;
+
+  /* Keep collection values as text, see Value_table::m_lazy */
+  bool m_lazy_collections{};
+
+  /* Change callbacks indexed by option id, sized on demand */
+  std::vector<std::function<void(const Value_variant&)>> m_callbacks;
+
+  /* Problems found before parse(), e.g. bad environment values */
+  std::vector<Diagnostic> m_pending_diagnostics;
+
+  /* Rendered by help_text(), shared with derived options. Reset by
+  writable_table() and clear(). */
+  mutable std::shared_ptr<const std::string> m_help;
+
+  /* Usage line for a program name followed by the help text */
+  struct Help_message {
+    std::string m_program_name;
+    std::string m_text;
+  };
+
+  /* Built by help_message() for the last program name, reset with m_help */
+  mutable std::shared_ptr<const Help_message> m_help_message;
+
+  [[nodiscard]] inline std::string_view help_message(std::string_view program_name) const;
+};
+
+template<Option_value T>
+inline Option_handle<T> Options::add_option(Option_descriptor&& desc) {
+  if (desc.m_short_name.empty() && desc.m_long_name.empty()) {
+    throw_error<Option_error>("Option must have either short or long name");
+  }
+
+  if (!m_schema.empty()) {
+    throw_error<Option_error>(std::format("Cannot add option '{}' to options built from a schema", value_key(desc)));
+  }
+
+  const bool has_default = desc.m_default_value.has_value();
+
+  if (!has_default) {
+    desc.m_default_value = T{};
+  }
+
+  auto& table = writable_table();
+
+  /* Re-adding an option reuses its slot */
+  std::size_t id = m_values.size();
+
+  if (auto existing = find_value_id(value_key(desc))) {
+    id = *existing;
+
+    /* Names of the option it replaces */
+    const auto& old = table.m_descriptors[id];
+
+    if (auto it = table.m_short_names.find(std::string_view(old.m_short_name)); it != table.m_short_names.end() && it->second == id) {
+      table.m_short_names.erase(it);
+    }
+    if (auto it = table.m_long_names.find(std::string_view(old.m_long_name)); it != table.m_long_names.end() && it->second == id) {
+      table.m_long_names.erase(it);
+    }
+
+    table.m_descriptors[id] = std::move(desc);
+    table.m_types[id] = std::uint8_t(type_of<T>);
+    std::erase(table.m_required, id);
+
+    for (std::size_t source = 0; source < value_source_count; ++source) {
+      if (m_layers[source] && m_layers[source]->contains(id)) {
+        writable_layer(Value_source(source)).erase(id);
+      }
+    }
+    m_values.set(id, nullptr);
+
+    /* Text given for the option it replaces */
+    if (id < m_values.m_lazy.size()) {
+      m_values.m_lazy[id].reset();
+    }
+  } else {
+    table.m_descriptors.push_back(std::move(desc));
+    table.m_types.push_back(std::uint8_t(type_of<T>));
+    m_values.resize(id + 1);
+  }
+
+  const auto& option = table.m_descriptors[id];
+  const auto& key = value_key(option);
+  const Option_handle<T> handle{id};
+
+  if (!option.m_short_name.empty()) {
+    table.m_short_names.insert_or_assign(std::pmr::string(option.m_short_name, m_resource), id);
+  }
+
+  if (!option.m_long_name.empty()) {
+    table.m_long_names.insert_or_assign(std::pmr::string(option.m_long_name, m_resource), id);
+  }
+
+  if (option.m_required) {
+    table.m_required.push_back(id);
+  }
+
+  if (has_default) {
+    handle_value(id, key, *option.m_default_value, Value_source::defaults);
+  }
+
+  /* The environment overrides the default */
+  if (option.m_env_var && !m_env_deferred) {
+    if (auto env_value = get_env_value(*option.m_env_var); !env_value.empty()) {
+      if (auto value = parse_value(*option.m_default_value, env_value)) {
+        handle_value(handle.m_id, key, *value, Value_source::env);
+      } else {
+        /* Reported by the next parse() */
+        m_pending_diagnostics.push_back({
+          .m_code = Diagnostic_code::invalid_value,
+          .m_option = *option.m_env_var,
+          .m_value = std::string(env_value)
+        });
+      }
+    }
+  }
+
+  return handle;
+}
+
+template<std::size_t N>
+inline Options::Options(const Schema<N>& schema, std::pmr::memory_resource* resource)
+  : m_resource(resource), m_schema(schema.view()), m_values(Value_table::allocator_type(resource)) {
+
+  m_values.resize(N);
+
+  /* Environment variable names of the schema */
+  std::unordered_map<std::string_view, std::size_t> env_ids;
+
+  for (std::size_t id = 0; id < N; ++id) {
+    const auto& spec = m_schema.m_specs[id];
+    const auto& type = empty_value(spec.m_type);
+
+    if (spec.m_default_value) {
+      if (auto value = parse_value(type, *spec.m_default_value)) {
+        store(id, std::move(*value), Value_source::defaults);
+      } else {
+        throw_error<Option_error>(std::format("Invalid default value for option '{}'", spec.key()));
+      }
+    }
+
+    if (spec.m_env_var) {
+      env_ids.emplace(*spec.m_env_var, id);
+    }
+  }
+
+  if (env_ids.empty()) {
+    return;
+  }
+
+  /* One pass over the environment instead of a getenv() per option */
+  for_each_env([&](std::string_view name, std::string_view env_value) {
+    auto it = env_ids.find(name);
+
+    if (it == env_ids.end() || env_value.empty()) {
+      return;
+    }
+
+    if (auto value = parse_value(empty_value(m_schema.m_specs[it->second].m_type), env_value)) {
+      store(it->second, std::move(*value), Value_source::env);
+    } else {
+      m_pending_diagnostics.push_back({
+        .m_code = Diagnostic_code::invalid_value,
+        .m_option = std::string(name),
+        .m_value = std::string(env_value)
+      });
+    }
+  });
+}
+
+template<Option_value T>
+inline std::optional<T> Options::get(std::string_view name) const {
+  if (auto id = find_value_id(name)) {
+    if (const auto* value = (*this)[Option_handle<T>{*id}]; value != nullptr) {
+      return *value;
+    }
+  }
+  return std::nullopt;
+}
+
+inline std::optional<Options::Option_ref> Options::resolve(std::string_view name, bool is_short) const {
+  if (!m_schema.empty()) {
+    if (auto id = m_schema.find(name, is_short)) {
+      const auto& spec = m_schema.m_specs[*id];
+      return Option_ref{*id, spec.key(), &empty_value(spec.m_type)};
+    }
+    return std::nullopt;
+  }
+
+  const auto& names = is_short ? m_table->m_short_names : m_table->m_long_names;
+
+  if (auto it = names.find(name); it != names.end()) {
+    const auto id = it->second;
+    return Option_ref{id, value_key(m_table->m_descriptors[id]), &empty_value(m_table->m_types[id])};
+  }
+  return std::nullopt;
+}
+
+inline std::optional<std::size_t> Options::find_value_id(std::string_view name) const {
+  return cli::find_value_id(m_schema, *m_table, name);
+}
+
+inline void Options::handle_value(std::size_t id, std::string_view name, const Value_variant& value, Value_source source) {
+  /* Validate the value if a validator exists */
+  if (!validate_option(name, value)) {
+    throw_error<Validation_error>(std::format("Validation failed for option '{}'", name));
+  }
+  store(id, Value_variant(value), source);
+}
+
+inline void Options::store(std::size_t id, Value_variant&& value, Value_source source) {
+  const auto& slot = writable_layer(source).insert_or_assign(id, std::move(value)).first->second;
+
+  if (source == Value_source::argv && id < m_values.m_lazy.size()) {
+    m_values.m_lazy[id].reset();
+  }
+
+  /* A layer above keeps the current value */
+  for (auto above = std::size_t(source) + 1; above < value_source_count; ++above) {
+    if (m_layers[above] && m_layers[above]->contains(id)) {
+      return;
+    }
+  }
+
+  m_values.set(id, &slot);
+
+  if (id < m_callbacks.size() && m_callbacks[id]) {
+    m_callbacks[id](slot);
+  }
+}
+
+inline void Options::store_lazy(const Option_ref& option, std::string_view text) {
+  auto& lazy = m_values.m_lazy;
+
+  if (lazy.size() <= option.m_id) {
+    lazy.resize(m_values.size());
+  }
+
+  /* The empty value of the type holds the place of the text in the layer */
+  m_values.set(option.m_id, &writable_layer(Value_source::argv).insert_or_assign(option.m_id, empty_value(option.m_type->index())).first->second);
+  lazy[option.m_id] = std::allocate_shared<const Lazy_value>(std::pmr::polymorphic_allocator<>(m_resource), std::string(option.m_key), text, option.m_type->index());
+}
+
+inline Value_layer& Options::writable_layer(Value_source source) {
+  auto& layer = m_layers[std::size_t(source)];
 
-  /* Add an option with type deduction */
-  template<Option_value T>
-  inline void add_option(const Option_descriptor& desc);
+  if (!layer) {
+    layer = std::allocate_shared<Value_layer>(std::pmr::polymorphic_allocator<>(m_resource));
+  } else if (layer.use_count() > 1) {
+    /* Shared with a snapshot or a derived Options, write to a copy */
+    layer = std::allocate_shared<Value_layer>(std::pmr::polymorphic_allocator<>(m_resource), *layer);
 
-  /* Parse command line arguments */
-  [[nodiscard]] inline bool parse(int argc, char* argv[]);
+    for (const auto& [id, value] : *layer) {
+      resolve_value(id);
+    }
+  }
+  return *layer;
+}
 
-  /* Get option value with type checking */
-  template<Option_value T>
-  [[nodiscard]] std::optional<T> get(const std::string& name) const;
+inline void Options::resolve_value(std::size_t id) {
+  for (auto source = value_source_count; source-- > 0;) {
+    if (const auto& layer = m_layers[source]) {
+      if (auto it = layer->find(id); it != layer->end()) {
+        m_values.set(id, &it->second);
+        return;
+      }
+    }
+  }
+  m_values.set(id, nullptr);
+}
 
-  /* Check if option exists */
-   [[nodiscard]] inline bool has_value(const std::string& name) const {
-    return m_values.contains(name) && m_values.at(name).has_value();
+inline const Value_variant* Options::current_value(std::size_t id) const {
+  if (id < m_values.m_lazy.size() && m_values.m_lazy[id]) {
+    return m_values.m_lazy[id]->get(m_table->m_validators);
   }
 
-  /* Print help message */
-  inline void print_help(std::string_view program_name) const;
+  for (auto source = value_source_count; source-- > 0;) {
+    if (const auto& layer = m_layers[source]) {
+      if (auto it = layer->find(id); it != layer->end()) {
+        return &it->second;
+      }
+    }
+  }
+  return nullptr;
+}
 
-  /* Clear all options and values */
-  inline void clear();
+inline std::expected<std::size_t, std::vector<Diagnostic>> Options::import_env(std::string_view prefix) {
+  struct Env_option {
+    /* Name the option value is stored under */
+    std::string_view m_key{};
+    bool m_explicit{};
+  };
 
-  /* Validation callback type */
-  using Validation_callback = std::function<bool(const Value_variant&)>;
+  /* Environment variable name to the option it sets. Explicit names go in
+  first so that they win over an equal prefix name. */
+  String_map<Env_option> env_options;
+  std::vector<std::pair<std::string_view, std::string_view>> prefixed;
 
-  /* Add validation for an option */
-  inline void add_validation(const std::string& name, Validation_callback callback);
+  auto add = [&](std::string_view key, const auto& env_var, std::string_view long_name) {
+    if (env_var) {
+      env_options.insert_or_assign(std::string(*env_var), Env_option{key, true});
+    }
+    if (!prefix.empty() && !long_name.empty()) {
+      prefixed.emplace_back(key, long_name);
+    }
+  };
 
-  /* Check if value is a boolean */
-  [[nodiscard]] static inline bool is_boolean(std::string_view value) {
-    return value == "true" || value == "false" || value == "1" || value == "0" || value == "yes" || value == "no" || value == "on" || value == "off";
+  if (!m_schema.empty()) {
+    for (const auto& spec : m_schema.m_specs) {
+      add(spec.key(), spec.m_env_var, spec.m_long_name);
+    }
+  } else {
+    for (const auto& desc : m_table->m_descriptors) {
+      add(value_key(desc), desc.m_env_var, desc.m_long_name);
+    }
   }
 
-  /* Get all positional arguments */
-  [[nodiscard]] inline const std::vector<std::string>& positional_args() const {
-    return m_positional_args;
+  for (const auto& [key, long_name] : prefixed) {
+    env_options.try_emplace(env_var_name(prefix, long_name), Env_option{key, false});
   }
 
-private:
-  [[nodiscard]] inline bool is_option(std::string_view arg) const;
+  struct Match {
+    std::string_view m_env_var{};
+    std::string_view m_value{};
+    bool m_explicit{};
+  };
 
-  [[nodiscard]] inline bool handle_option(const std::string& name, const std::string& value, bool is_short = false);
+  /* Option key to the environment variable setting it */
+  String_map<Match> matches;
 
-  template<typename T>
-  inline void handle_value(const std::string& name, const Value_variant& value);
+  for_each_env([&](std::string_view name, std::string_view value) {
+    if (auto it = env_options.find(name); it != env_options.end() && !value.empty()) {
+      const auto& [key, is_explicit] = it->second;
+      auto [match, inserted] = matches.try_emplace(std::string(key), Match{name, value, is_explicit});
 
-  [[nodiscard]] inline std::string get_env_value(const std::string& name) const {
-    if (const char* env = std::getenv(name.c_str())) {
-      return env;
-    } else {
-      return {};
+      if (!inserted && is_explicit && !match->second.m_explicit) {
+        match->second = Match{name, value, is_explicit};
+      }
     }
+  });
+
+  std::vector<Assignment> assignments;
+
+  assignments.reserve(matches.size());
+
+  for (const auto& [key, match] : matches) {
+    assignments.push_back({key, match.m_value});
   }
 
-  [[nodiscard]] inline bool validate_option(const std::string& name, const std::string& value) const {
-    if (auto it = m_validators.find(name); it != m_validators.end()) {
-      if (!it->second(value)) {
-        log_error(std::format("Validation failed for option '{}'", name));
-        return false;
+  auto result = set(assignments, Value_source::env);
+
+  if (!result) {
+    /* Report the variable, not the option */
+    for (auto& diagnostic : result.error()) {
+      if (auto it = matches.find(diagnostic.m_option); it != matches.end()) {
+        diagnostic.m_option = std::string(it->second.m_env_var);
       }
     }
-    return true;
   }
+  return result;
+}
 
-  void apply_default_values();
+inline std::optional<Value_source> Options::source(std::string_view name) const {
+  if (auto id = find_value_id(name)) {
+    for (auto source = value_source_count; source-- > 0;) {
+      if (m_layers[source] && m_layers[source]->contains(*id)) {
+        return Value_source(source);
+      }
+    }
+  }
+  return std::nullopt;
+}
 
-private:
-  bool m_allow_unrecognized{};
-  std::vector<std::string> m_positional_args;
-  std::unordered_map<std::string, Option_descriptor> m_short_names;
-  std::unordered_map<std::string, Option_descriptor> m_long_names;
-  std::unordered_map<std::string, Validation_callback> m_validators;
-  std::unordered_map<std::string, std::optional<Value_variant>> m_values;
-};
+inline void Options::reset(Value_source source) {
+  if (source == Value_source::argv) {
+    m_values.m_lazy.clear();
 
-template<Option_value T>
-inline void Options::add_option(const Option_descriptor& desc) {
-  if (desc.m_short_name.empty() && desc.m_long_name.empty()) {
-    throw Option_error("Option must have either short or long name");
+    /* No value points into the response files anymore */
+    for (const auto& file : m_response_files) {
+      std::erase(m_storage, file.m_file);
+    }
+    m_response_files.clear();
   }
 
-  auto default_value = desc.m_default_value;
+  if (auto layer = std::exchange(m_layers[std::size_t(source)], nullptr)) {
+    for (const auto& [id, value] : *layer) {
+      resolve_value(id);
+
+      if (id < m_callbacks.size() && m_callbacks[id]) {
+        if (const auto* value = current_value(id)) {
+          m_callbacks[id](*value);
+        }
+      }
+    }
+  }
+}
 
-  Option_descriptor option = desc;
+inline bool Options::reset(std::string_view name, Value_source source) {
+  auto option = resolve(name, false);
 
-  if (!default_value) {
-    option.m_default_value = T{};
+  if (!option) {
+    option = resolve(name, true);
   }
 
-  /* Store option descriptors */
-  if (!option.m_short_name.empty()) {
-    m_short_names[option.m_short_name] = option;
+  const auto id = option ? option->m_id : 0;
+
+  if (!option || !m_layers[std::size_t(source)] || !m_layers[std::size_t(source)]->contains(id)) {
+    return false;
   }
 
-  if (!option.m_long_name.empty()) {
-    m_long_names[option.m_long_name] = option;
+  writable_layer(source).erase(id);
+
+  if (source == Value_source::argv && id < m_values.m_lazy.size()) {
+    m_values.m_lazy[id].reset();
   }
 
-  /* Check environment variable first */
-  if (option.m_env_var) {
-    if (auto env_value = get_env_value(*option.m_env_var); !env_value.empty()) {
-      if (!default_value) {
-        handle_value<T>(option.m_long_name, env_value);
-      } else {
-        handle_value<T>(option.m_long_name, *default_value);
-      }
-      return;
+  /* A layer above keeps the current value */
+  for (auto above = std::size_t(source) + 1; above < value_source_count; ++above) {
+    if (m_layers[above] && m_layers[above]->contains(id)) {
+      return true;
     }
   }
-  /* Apply default value if provided */
-  if (default_value) {
-    handle_value<T>(option.m_long_name, *default_value);
+
+  resolve_value(id);
+
+  if (id < m_callbacks.size() && m_callbacks[id]) {
+    if (const auto* value = current_value(id)) {
+      m_callbacks[id](*value);
+    }
   }
+  return true;
 }
 
-template<Option_value T>
-inline std::optional<T> Options::get(const std::string& name) const {
-  if (auto it = m_values.find(name); it != m_values.end()) {
-    try {
-      if (it->second.has_value()) {
-        return std::get<T>(*it->second);
-      } else {
-        return std::nullopt;
+inline const Value_variant* Lazy_value::get(const Validator_map& validators) const {
+  std::call_once(m_once, [&] {
+    if (auto value = Options::parse_value(empty_value(m_type), m_text); !value) {
+      m_error = Diagnostic_code::invalid_value;
+    } else if (!validate_value(validators, m_key, *value)) {
+      m_error = Diagnostic_code::validation_failed;
+    } else {
+      m_value = std::move(*value);
+    }
+  });
+
+  return m_value ? &*m_value : nullptr;
+}
+
+inline std::expected<void, std::vector<Diagnostic>> Options::validate_all() const {
+  std::vector<Diagnostic> diagnostics;
+
+  for (const auto& lazy : m_values.m_lazy) {
+    if (lazy) {
+      if (auto error = lazy->error(m_table->m_validators)) {
+        diagnostics.push_back({.m_code = *error, .m_option = lazy->m_key, .m_value = std::string(lazy->m_text)});
       }
-    } catch (const std::bad_variant_access&) {
-      return std::nullopt;
     }
   }
-  return std::nullopt;
+
+  if (!diagnostics.empty()) {
+    return std::unexpected(std::move(diagnostics));
+  }
+  return {};
 }
 
-template<typename T>
-inline void Options::handle_value(const std::string& name, const Value_variant& value) {
-  try {
-    std::visit([&name, &value, this](auto&& v) -> auto {
-      if constexpr (std::same_as<T, bool>) {
+inline Options Options::derive(std::pmr::memory_resource* resource) const {
+  Options options(resource != nullptr ? resource : m_resource);
+
+  options.m_allow_unrecognized = m_allow_unrecognized;
+  options.m_schema = m_schema;
+  options.m_table = m_table;
+  options.m_layers = m_layers;
+  options.m_values = m_values;
+  options.m_response_files_enabled = m_response_files_enabled;
+  options.m_response_files = m_response_files;
+  options.m_storage = m_storage;
+  options.m_lazy_collections = m_lazy_collections;
+  options.m_help = m_help;
+  options.m_help_message = m_help_message;
+
+  return options;
+}
+
+template<Option_value T>
+inline void Options::on_change(Option_handle<T> handle, std::type_identity_t<std::function<void(const T&)>> callback) {
+  if (handle.m_id >= m_values.size()) {
+    throw_error<Option_error>("Change callback for an unknown option");
+  }
 
-        m_values[name] = v;
+  if (m_callbacks.size() <= handle.m_id) {
+    m_callbacks.resize(m_values.size());
+  }
 
-      } else if constexpr (std::same_as<T, int>) {
+  m_callbacks[handle.m_id] = [callback = std::move(callback)](const Value_variant& value) {
+    if (const auto* v = std::get_if<T>(&value)) {
+      callback(*v);
+    }
+  };
 
-        m_values[name] = v;
+  if (const auto* value = current_value(handle.m_id)) {
+    m_callbacks[handle.m_id](*value);
+  }
+}
 
-      } else if constexpr (std::same_as<T, double>) {
+inline std::expected<Parse_result, std::vector<Diagnostic>> Options::try_parse(int argc, char* argv[]) {
+  /* argv outlives the options, names and values are kept as views into it */
+  return parse_args(std::span<char* const>(argv + std::min(argc, 1), argv + argc));
+}
 
-        m_values[name] = v;
+inline std::expected<Parse_result, std::vector<Diagnostic>> Options::try_parse(std::span<const std::string_view> args) {
+  return parse_args(args);
+}
 
-      } else if constexpr (std::same_as<T, std::string>) {
+template<typename Args>
+inline void Options::expand_args(const Args& args, int depth, std::vector<std::string_view>& out, std::vector<Diagnostic>& diagnostics) {
+  for (std::string_view arg : args) {
+    if (!arg.starts_with('@') || arg.size() == 1) {
+      out.push_back(arg);
+      continue;
+    }
 
-        m_values[name] = v;
+    const auto path = arg.substr(1);
 
-      } else if constexpr (requires { typename T::array_type; }) {
+    if (depth >= max_response_file_depth) {
+      diagnostics.push_back({
+        .m_code = Diagnostic_code::bad_response_file,
+        .m_option = std::string(path),
+        .m_value = "nested too deeply"
+      });
+      continue;
+    }
 
-        m_values[name] = v;
+    auto file = map_response_file(std::string(path));
 
-      } else if constexpr (requires { typename T::mapped_type; }) {
+    if (!file) {
+      diagnostics.push_back({
+        .m_code = Diagnostic_code::bad_response_file,
+        .m_option = std::string(path),
+        .m_value = std::strerror(errno)
+      });
+      continue;
+    }
 
-        m_values[name] = v;
+    std::vector<std::string_view> file_args;
 
-      } else {
-        throw Option_error(std::format("Unsupported option type for '{}'", name));
-      }
+    split_response_file(file->view(), file_args);
+    expand_args(file_args, depth + 1, out, diagnostics);
+  }
+}
 
-      /* Validate the parsed value if a validator exists */
-      if (auto it = m_validators.find(name); it != m_validators.end()) {
-        if (!it->second(value)) {
-          throw Validation_error(std::format("Validation failed for option '{}'", name));
-        }
-      }
+inline std::shared_ptr<const Mapped_file> Options::map_response_file(const std::string& path) {
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
 
-    }, value);
+  if (fd == -1) {
+    return nullptr;
+  }
 
-  } catch (const Parse_error&) {
-    /* Re-throw parsing errors */
-    throw;
-  } catch (const Validation_error&) {
-    /* Re-throw validation errors */
-    throw;
-  } catch (const std::exception& e) {
-    throw Parse_error(std::format("Failed to parse option '{}' : {}", name, e.what()));
+  struct stat st {};
+  std::shared_ptr<const Mapped_file> result;
+
+  if (::fstat(fd, &st) == 0) {
+    auto same = [&](const Response_file& file) {
+      return file.m_device == st.st_dev && file.m_inode == st.st_ino && file.m_size == st.st_size &&
+             file.m_modified.tv_sec == st.st_mtim.tv_sec && file.m_modified.tv_nsec == st.st_mtim.tv_nsec;
+    };
+
+    if (auto it = std::ranges::find_if(m_response_files, same); it != m_response_files.end()) {
+      result = it->m_file;
+    } else if (auto file = Mapped_file::map(fd)) {
+      /* Values of earlier parses may still point into an older mapping of
+      the same file, so that one is kept too */
+      result = std::make_shared<const Mapped_file>(std::move(*file));
+      m_storage.push_back(result);
+      m_response_files.push_back({.m_device = st.st_dev, .m_inode = st.st_ino, .m_size = st.st_size, .m_modified = st.st_mtim, .m_file = result});
+    }
   }
+
+  const auto error = errno;
+  ::close(fd);
+  errno = error;
+
+  return result;
 }
 
-inline bool Options::parse(int argc, char* argv[]) {
-  try {
-    std::vector<std::string_view> args(argv + 1, argv + argc);
+template<typename Args>
+inline std::expected<Parse_result, std::vector<Diagnostic>> Options::parse_args(const Args& input) {
+  Parse_result result;
+  auto diagnostics = std::move(m_pending_diagnostics);
+
+  m_pending_diagnostics.clear();
+
+  /* Response files are expanded into views of their mappings */
+  std::vector<std::string_view> expanded;
+
+  const bool expand = m_response_files_enabled && std::ranges::any_of(input, [](std::string_view arg) {
+    return arg.starts_with('@');
+  });
+
+  if (expand) {
+    expand_args(input, 0, expanded, diagnostics);
+  }
+
+  auto parse = [&](const auto& args) {
+    auto apply = [&](std::string_view name, std::string_view value, bool is_short, int arg_index) {
+      if (auto error = handle_option(name, value, is_short); error) {
+        diagnostics.push_back({
+          .m_code = *error,
+          .m_option = std::string(name),
+          .m_value = std::string(value),
+          .m_arg_index = arg_index
+        });
+      } else {
+        ++result.m_options_set;
+      }
+    };
+
+    const std::size_t n = args.size();
+
+    for (std::size_t i = 0; i < n; ++i) {
+      std::string_view arg = args[i];
 
-    for (auto it = args.begin(); it != args.end(); ++it) {
-      std::string_view arg = *it;
+      /* Position in the argument list, counting the program name */
+      const int arg_index = int(i) + 1;
 
       if (arg.starts_with("--")) {
         /* Long option */
-        auto name = std::string(arg.substr(2));
+        auto name = arg.substr(2);
         auto value_pos = name.find('=');
 
-        if (value_pos != std::string::npos) {
+        if (value_pos != std::string_view::npos) {
           /* Format: --name=value */
-          auto value = name.substr(value_pos + 1);
-          name = name.substr(0, value_pos);
-
-          if (!handle_option(name, std::string(value))) {
-            return false;
-          }
+          apply(name.substr(0, value_pos), name.substr(value_pos + 1), false, arg_index);
+        } else if (i + 1 < n && !is_option(args[i + 1])) {
+          /* Format: --name value */
+          apply(name, args[++i], false, arg_index);
         } else {
-          /* Format: --name value or --flag */
-          if (it + 1 != args.end() && !is_option(*(it + 1))) {
-            if (!handle_option(name, std::string(*(++it)))) {
-              return false;
-            }
-          } else {
-            if (!handle_option(name, "true")) {
-              return false;
-            }
-          }
+          /* Format: --flag */
+          apply(name, "true", false, arg_index);
         }
       } else if (arg.starts_with('-') && arg.length() > 1) {
         /* Short option */
-        auto name = std::string(arg.substr(1));
+        auto name = arg.substr(1);
 
-        if (it + 1 != args.end() && !is_option(*(it + 1))) {
-          if (!handle_option(name, std::string(*(++it)), true)) {
-            return false;
-          }
+        if (i + 1 < n && !is_option(args[i + 1])) {
+          apply(name, args[++i], true, arg_index);
         } else {
-          if (!handle_option(name, "true", true)) {
-            return false;
-          }
+          apply(name, "true", true, arg_index);
         }
       } else {
         /* Positional argument */
-        m_positional_args.push_back(std::string(arg));
+        add_positional(arg);
+        ++result.m_positional_count;
       }
     }
+  };
 
-    /* Check required options */
-    for (const auto& [name, desc] : m_long_names) {
-      if (desc.m_required && !has_value(name)) {
-        log_error(std::format("Required option '{}' is missing", name));
-        return false;
-      }
+  if (expand) {
+    parse(expanded);
+  } else {
+    parse(input);
+  }
+
+  /* Check required options */
+  for (const auto id : m_table->m_required) {
+    if (!m_values.has_value(id)) {
+      diagnostics.push_back({.m_code = Diagnostic_code::missing_required, .m_option = value_key(m_table->m_descriptors[id])});
+    }
+  }
+
+  for (std::size_t id = 0; id < m_schema.m_specs.size(); ++id) {
+    if (m_schema.m_specs[id].m_required && !m_values.has_value(id)) {
+      diagnostics.push_back({.m_code = Diagnostic_code::missing_required, .m_option = std::string(m_schema.m_specs[id].key())});
+    }
+  }
+
+  if (!diagnostics.empty()) {
+    return std::unexpected(std::move(diagnostics));
+  }
+  return result;
+}
+
+inline std::expected<std::size_t, Diagnostic> Options::read_positionals(int fd, char delimiter) {
+  auto result = read_delimited(fd, delimiter, [this](std::string_view arg) {
+    add_positional(arg);
+  });
+
+  if (!result) {
+    return std::unexpected(Diagnostic{
+      .m_code = Diagnostic_code::read_error,
+      .m_value = std::strerror(result.error())
+    });
+  }
+  return *result;
+}
+
+inline std::expected<std::size_t, std::vector<Diagnostic>> Options::set(std::span<const Assignment> assignments, Value_source source) {
+  std::vector<Diagnostic> diagnostics;
+  std::vector<std::pair<std::size_t, Value_variant>> values;
+
+  values.reserve(assignments.size());
+
+  for (const auto& [name, value] : assignments) {
+    auto option = resolve(name, false);
+
+    if (!option) {
+      option = resolve(name, true);
+    }
+
+    std::optional<Diagnostic_code> error;
+
+    if (!option) {
+      error = Diagnostic_code::unknown_option;
+    } else if (auto result = parse_value(*option->m_type, value); !result) {
+      error = Diagnostic_code::invalid_value;
+    } else if (!validate_option(option->m_key, *result)) {
+      error = Diagnostic_code::validation_failed;
+    } else {
+      values.emplace_back(option->m_id, std::move(*result));
+    }
+
+    if (error) {
+      diagnostics.push_back({.m_code = *error, .m_option = std::string(name), .m_value = std::string(value)});
     }
+  }
+
+  if (!diagnostics.empty()) {
+    return std::unexpected(std::move(diagnostics));
+  }
 
-    return true;
-  } catch (const std::exception& e) {
-    log_error("Parsing arguments: ", e.what());
+  for (auto& [id, value] : values) {
+    store(id, std::move(value), source);
+  }
+  return values.size();
+}
+
+inline bool Options::parse(int argc, char* argv[]) {
+  auto result = try_parse(argc, argv);
+
+  if (!result) {
+    for (const auto& diagnostic : result.error()) {
+      log_error(diagnostic.to_string());
+    }
     return false;
   }
+  return true;
 }
 
-inline void Options::print_help(std::string_view program_name) const {
-  log_info("Usage: ", program_name, " [OPTIONS] [ARGUMENTS]");
-  log_info("Options:");
+/* Longest collection default shown in the help, longer ones are cut at an
+element boundary and followed by the number of elements */
+inline constexpr std::size_t help_default_width = 40;
+
+inline void help_append_default(std::string& out, const Value_variant& value) {
+  std::visit([&](auto&& v) {
+    using T = std::decay_t<decltype(v)>;
+
+    if constexpr (Basic_value<T>) {
+      std::format_to(std::back_inserter(out), " [default: {}]", v);
+    } else {
+      out += " [default: ";
+
+      const auto start = out.size();
+      std::size_t shown = 0;
+
+      for (const auto& element : v) {
+        if (out.size() - start > help_default_width) {
+          break;
+        }
+        if (shown++ > 0) {
+          out += ',';
+        }
+        if constexpr (requires { typename T::array_type; }) {
+          std::format_to(std::back_inserter(out), "{}", element);
+        } else {
+          std::format_to(std::back_inserter(out), "{{{}={}}}", element.first, element.second);
+        }
+      }
+
+      if (shown < v.size()) {
+        std::format_to(std::back_inserter(out), ",... ({} values)", v.size());
+      }
+      out += ']';
+    }
+  }, value);
+}
+
+inline const std::string& Options::help_text() const {
+  if (m_help) {
+    return *m_help;
+  }
 
   /* Collect and sort option descriptors */
   std::vector<const Option_descriptor*> descriptors;
-  descriptors.reserve(m_long_names.size());
+  descriptors.reserve(m_table->m_descriptors.size() + m_schema.m_specs.size());
 
-  for (const auto& [name, desc] : m_long_names) {
+  for (const auto& desc : m_table->m_descriptors) {
+    if (!desc.m_long_name.empty()) {
+      descriptors.push_back(&desc);
+    }
+  }
+
+  /* Schema options are rendered through temporary descriptors */
+  std::vector<Option_descriptor> schema_descriptors;
+  schema_descriptors.reserve(m_schema.m_specs.size());
+
+  for (const auto& spec : m_schema.m_specs) {
+    if (spec.m_long_name.empty()) {
+      continue;
+    }
+
+    auto& desc = schema_descriptors.emplace_back(Option_descriptor{
+      .m_short_name = std::string(spec.m_short_name),
+      .m_long_name = std::string(spec.m_long_name),
+      .m_description = std::string(spec.m_description),
+      .m_required = spec.m_required,
+      .m_default_value = empty_value(spec.m_type)
+    });
+
+    if (spec.m_default_value) {
+      desc.m_default_value = parse_value(empty_value(spec.m_type), *spec.m_default_value).value_or(empty_value(spec.m_type));
+    }
+    if (spec.m_env_var) {
+      desc.m_env_var = std::string(*spec.m_env_var);
+    }
     descriptors.push_back(&desc);
   }
 
@@ -328,66 +1577,126 @@ inline void Options::print_help(std::string_view program_name) const {
     return a->m_long_name < b->m_long_name;
   });
 
-  /* Print each option */
+  std::string text = "Options:\n";
+  std::string option_str;
+
   for (const auto* desc : descriptors) {
-    std::string option_str = "  ";
+    option_str = "  ";
 
     /* Add short name if available */
     if (!desc->m_short_name.empty()) {
-      option_str += std::format("-{}, ", desc->m_short_name);
+      std::format_to(std::back_inserter(option_str), "-{}, ", desc->m_short_name);
     } else {
       option_str += "    ";
     }
 
     /* Add long name */
-    option_str += std::format("--{}", desc->m_long_name);
+    option_str += "--";
+    option_str += desc->m_long_name;
 
     /* Add required flag */
     if (desc->m_required) {
       option_str += " (required)";
     }
 
-    /* We should always have a default valuei, even if it's an empty value
+    /* We should always have a default value, even if it's an empty value
     because that's how we capture the exact type of the option. */
     assert(desc->m_default_value);
-
-    std::visit([&](auto&& v) {  
-      using T = std::decay_t<decltype(v)>;
-
-      if constexpr (Basic_value<T>) {
-        option_str += std::format(" [default: {}]", v);
-      } else if constexpr (requires { typename T::array_type; }) {
-        option_str += std::format(" [default: {}]", v.to_string());
-      } else if constexpr (requires { typename T::mapped_type; }) {
-        option_str += std::format(" [default: {}]", v.to_string());
-      } else {
-        throw Option_error(std::format("Unsupported option type for '{}'", desc->m_long_name));
-      }
-    }, *desc->m_default_value);
+    help_append_default(option_str, *desc->m_default_value);
 
     /* Add environment variable if available */
     if (desc->m_env_var) {
-      option_str += std::format(" [env: {}]", *desc->m_env_var);
+      std::format_to(std::back_inserter(option_str), " [env: {}]", *desc->m_env_var);
+    }
+
+    /* Option with description */
+    std::format_to(std::back_inserter(text), "{:<50} {}\n", option_str, desc->m_description);
+  }
+
+  m_help = std::make_shared<const std::string>(std::move(text));
+  return *m_help;
+}
+
+inline void Options::print_help(std::string_view program_name) const {
+  log_info("Usage: ", program_name, " [OPTIONS] [ARGUMENTS]");
+
+  /* One line per call, without the newline */
+  std::string_view text = help_text();
+
+  while (!text.empty()) {
+    const auto end = text.find('\n');
+
+    log_info(text.substr(0, end));
+    text.remove_prefix(end + 1);
+  }
+}
+
+inline std::string_view Options::help_message(std::string_view program_name) const {
+  if (!m_help_message || m_help_message->m_program_name != program_name) {
+    constexpr std::string_view usage = "Usage: ";
+    constexpr std::string_view arguments = " [OPTIONS] [ARGUMENTS]\n";
+
+    const auto& text = help_text();
+    auto message = std::make_shared<Help_message>();
+
+    message->m_program_name = program_name;
+    message->m_text.reserve(usage.size() + program_name.size() + arguments.size() + text.size());
+    message->m_text.append(usage).append(program_name).append(arguments).append(text);
+
+    m_help_message = std::move(message);
+  }
+  return m_help_message->m_text;
+}
+
+inline void Options::print_help(std::ostream& out, std::string_view program_name) const {
+  const auto message = help_message(program_name);
+
+  /* One sputn(), so an unbuffered stream like std::cerr writes once */
+  out.write(message.data(), std::streamsize(message.size()));
+}
+
+inline std::expected<void, int> Options::print_help(int fd, std::string_view program_name) const {
+  auto message = help_message(program_name);
+
+  while (!message.empty()) {
+    const auto n = ::write(fd, message.data(), message.size());
+
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n < 0) {
+      return std::unexpected(errno);
     }
 
-    /* Print option with description */
-    log_info(std::format("{:<50} {}", option_str, desc->m_description));
+    /* Short write, skip what was written */
+    message.remove_prefix(std::size_t(n));
   }
+  return {};
 }
 
 inline void Options::clear() {
-  m_short_names.clear();
-  m_long_names.clear();
+  m_schema = {};
+  m_help.reset();
+  m_help_message.reset();
+  m_storage.clear();
+  m_response_files.clear();
+  m_callbacks.clear();
+  m_table = empty_option_table();
+  m_layers = {};
   m_values.clear();
-  m_validators.clear();
   m_positional_args.clear();
+  m_positional_callback = nullptr;
+  m_pending_diagnostics.clear();
+  m_allow_unrecognized = false;
+  m_env_deferred = false;
+  m_response_files_enabled = false;
+  m_lazy_collections = false;
 }
 
-inline void Options::add_validation(const std::string& name, Validation_callback callback) {
-  if (m_long_names.contains(name)) {
-    m_validators[name] = std::move(callback);
+inline void Options::add_validation(std::string_view name, Validation_callback callback) {
+  if (m_table->m_long_names.contains(name) || m_schema.find(name, false)) {
+    writable_table().m_validators.insert_or_assign(std::pmr::string(name, m_resource), std::move(callback));
   } else {
-    throw Option_error(std::format("Cannot add validation for unknown option '{}'", name));
+    throw_error<Option_error>(std::format("Cannot add validation for unknown option '{}'", name));
   }
 }
 
@@ -395,65 +1704,59 @@ inline bool Options::is_option(std::string_view arg) const {
   return arg.starts_with('-');
 }
 
-inline bool Options::handle_option(const std::string& name, const std::string& value, bool is_short) {
-  const auto& names = is_short ? m_short_names : m_long_names;
-  auto it = names.find(name);
+inline std::optional<Value_variant> Options::parse_value(const Value_variant& type, std::string_view value) {
+  return std::visit([value](auto&& v) -> std::optional<Value_variant> {
+    using T = std::decay_t<decltype(v)>;
 
-  if (it == names.end()) {
-    if (!m_allow_unrecognized) {
-      log_error(std::format("Unknown option: {}", name));
-      return false;
+    if constexpr (std::same_as<T, bool>) {
+      if (is_boolean(value)) {
+        return is_true(value);
+      }
+      return std::nullopt;
+    } else if constexpr (std::same_as<T, int> || std::same_as<T, double>) {
+      return parse_number<T>(value);
+    } else if constexpr (std::same_as<T, std::string>) {
+      /* Owned copy */
+      return std::string(value);
+    } else if constexpr (std::same_as<T, std::string_view>) {
+      /* Borrowed view, no copy */
+      return value;
     } else {
-      return true;
+      return T::parse(value);
     }
-  }
+  }, type);
+}
 
-  const auto& desc = it->second;
-  const auto& option_name = desc.m_long_name;
+inline std::optional<Diagnostic_code> Options::handle_option(std::string_view name, std::string_view value, bool is_short) {
+  auto option = resolve(name, is_short);
 
-  /* Validate value if validator exists */
-  if (!validate_option(option_name, value)) {
-    return false;
+  if (!option) {
+    if (!m_allow_unrecognized) {
+      return Diagnostic_code::unknown_option;
+    } else {
+      return std::nullopt;
+    }
   }
 
-  bool parsed{true};
+  if (m_lazy_collections && is_collection(*option->m_type) && !(option->m_id < m_callbacks.size() && m_callbacks[option->m_id])) {
+    store_lazy(*option, value);
+    return std::nullopt;
+  }
 
-  try {
+  auto result = parse_value(*option->m_type, value);
 
-    std::visit([&](auto&& v) {
-      using T = std::decay_t<decltype(v)>;
+  if (!result) {
+    return Diagnostic_code::invalid_value;
+  }
 
-      if constexpr (Basic_value<T>) {
-        if constexpr (std::same_as<T, bool>) {
-          /* Auto-detect type and store value */
-          if (is_boolean(value)) {
-            m_values[option_name] = is_true(value);
-          } else {
-            parsed = false;
-          }
-        } else if constexpr (std::same_as<T, int>) {
-          m_values[option_name] = std::stoi(value);
-        } else if constexpr (std::same_as<T, double>) {
-          m_values[option_name] = std::stod(value);
-        } else if constexpr (std::same_as<T, std::string>) {
-          m_values[option_name] = value;
-        }
-      } else {
-        auto result = T::parse(value);
+  /* Validate the converted value if a validator exists */
+  if (!validate_option(option->m_key, *result)) {
+    return Diagnostic_code::validation_failed;
+  }
 
-        if (result) {
-          m_values[option_name] = result;
-        } else {
-          parsed = false;
-        }
-      }
-    }, *desc.m_default_value);
+  store(option->m_id, std::move(*result));
 
-  } catch (const std::exception& e) {
-    log_error(std::format("Invalid value for option '{}'", name, e.what()));
-    return false;
-  }
-  return parsed;
+  return std::nullopt;
 }
 
 } // namespace cli
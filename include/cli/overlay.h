@@ -0,0 +1,176 @@
+#pragma once
+
+#include "cli/cli.h"
+
+namespace cli {
+
+/* Per request overrides on top of a snapshot, for servers that reuse the
+option schema for request parameters:
+
+  cli::Overlay overlay(*snapshot);
+
+  if (auto result = overlay.set("limits", "cpu=2,memory=512"); !result) {
+    return bad_request(result.error().to_string());
+  }
+  auto limits = overlay[limits_handle];
+
+Up to Capacity overrides are kept inline, reads fall through to the
+snapshot for everything else. Scalar and std::string_view values never
+allocate, and a std::string override reuses the buffer its slot had, or
+is assigned into the override it replaces, so a reused overlay (see
+clear()) does not touch the heap in the steady state.
+Collection values allocate their elements, std::string_view values point
+into the value text. Options are named by the name their value is stored
+under, the long name if there is one. The snapshot must outlive the
+overlay. */
+template<std::size_t Capacity = 8>
+struct Overlay {
+  explicit Overlay(const Options_snapshot& base) noexcept
+    : m_base(&base) {}
+
+  /* Convert, validate and set one override, replacing an earlier one */
+  [[nodiscard]] std::expected<void, Diagnostic> set(std::string_view name, std::string_view value);
+
+  /* Set overrides in order, stops at the first failure */
+  [[nodiscard]] std::expected<void, Diagnostic> set(std::span<const Assignment> assignments) {
+    for (const auto& [name, value] : assignments) {
+      if (auto result = set(name, value); !result) {
+        return result;
+      }
+    }
+    return {};
+  }
+
+  /* Get option value by handle, the override if there is one */
+  template<Option_value T>
+  [[nodiscard]] const T* operator[](Option_handle<T> handle) const noexcept {
+    if (const auto* slot = find(handle.m_id)) {
+      return std::get_if<T>(&slot->m_value);
+    }
+    return (*m_base)[handle];
+  }
+
+  /* Get option value with type checking */
+  template<Option_value T>
+  [[nodiscard]] std::optional<T> get(std::string_view name) const {
+    if (auto id = find_value_id(m_base->m_schema, *m_base->m_table, name)) {
+      if (const auto* value = (*this)[Option_handle<T>{*id}]; value != nullptr) {
+        return *value;
+      }
+    }
+    return std::nullopt;
+  }
+
+  [[nodiscard]] bool has_value(std::string_view name) const {
+    auto id = find_value_id(m_base->m_schema, *m_base->m_table, name);
+    return id && (find(*id) != nullptr || m_base->m_values.has_value(*id, m_base->m_table->m_validators));
+  }
+
+  /* Number of overrides */
+  [[nodiscard]] std::size_t size() const noexcept {
+    return m_size;
+  }
+
+  /* Drop the overrides, the slots keep their buffers for reuse */
+  void clear() noexcept {
+    m_size = 0;
+  }
+
+private:
+  struct Slot {
+    std::size_t m_id{};
+    Value_variant m_value{};
+  };
+
+  [[nodiscard]] const Slot* find(std::size_t id) const noexcept {
+    for (std::size_t i = 0; i < m_size; ++i) {
+      if (m_slots[i].m_id == id) {
+        return &m_slots[i];
+      }
+    }
+    return nullptr;
+  }
+
+  [[nodiscard]] Slot* find(std::size_t id) noexcept {
+    return const_cast<Slot*>(std::as_const(*this).find(id));
+  }
+
+  const Options_snapshot* m_base;
+  std::array<Slot, Capacity> m_slots{};
+  std::size_t m_size{};
+
+  /* Text of a std::string override while its new text is validated */
+  std::string m_previous;
+};
+
+template<std::size_t Capacity>
+inline std::expected<void, Diagnostic> Overlay<Capacity>::set(std::string_view name, std::string_view value) {
+  auto fail = [&](Diagnostic_code code) {
+    return std::unexpected(Diagnostic{.m_code = code, .m_option = std::string(name), .m_value = std::string(value)});
+  };
+
+  const auto id = find_value_id(m_base->m_schema, *m_base->m_table, name);
+
+  if (!id) {
+    return fail(Diagnostic_code::unknown_option);
+  }
+
+  auto* slot = find(*id);
+  const bool is_new = slot == nullptr;
+
+  if (is_new) {
+    if (m_size == Capacity) {
+      return fail(Diagnostic_code::too_many_overrides);
+    }
+    slot = &m_slots[m_size];
+  }
+
+  const auto type = option_type(m_base->m_schema, *m_base->m_table, *id);
+  const auto key = m_base->m_schema.empty() ? name : m_base->m_schema.m_specs[*id].key();
+
+  /* Overwrite a std::string override in place. Its old text is kept in
+  m_previous, which reuses its buffer too, for a failed validation. */
+  if (!is_new && type == type_of<std::string>) {
+    auto& text = std::get<std::string>(slot->m_value);
+
+    m_previous.assign(text);
+    text.assign(value);
+
+    if (!validate_value(m_base->m_table->m_validators, key, slot->m_value)) {
+      text.swap(m_previous);
+      return fail(Diagnostic_code::validation_failed);
+    }
+    return {};
+  }
+
+  const bool reuse = is_new && type == type_of<std::string> && std::holds_alternative<std::string>(slot->m_value);
+
+  Value_variant converted;
+
+  if (reuse) {
+    /* Take over the buffer of the free slot */
+    std::swap(converted, slot->m_value);
+    std::get<std::string>(converted).assign(value);
+  } else if (auto result = Options::parse_value(empty_value(type), value)) {
+    converted = std::move(*result);
+  } else {
+    return fail(Diagnostic_code::invalid_value);
+  }
+
+  if (!validate_value(m_base->m_table->m_validators, key, converted)) {
+    if (reuse) {
+      std::swap(converted, slot->m_value);
+    }
+    return fail(Diagnostic_code::validation_failed);
+  }
+
+  slot->m_id = *id;
+  slot->m_value = std::move(converted);
+
+  if (is_new) {
+    ++m_size;
+  }
+  return {};
+}
+
+} // namespace cli
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "cli/cli.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace cli {
+
+/* Read only memory mapping of a whole file */
+struct Mapped_file {
+  Mapped_file() = default;
+
+  ~Mapped_file() {
+    if (m_data != nullptr) {
+      ::munmap(m_data, m_size);
+    }
+  }
+
+  Mapped_file(const Mapped_file&) = delete;
+  Mapped_file& operator=(const Mapped_file&) = delete;
+
+  Mapped_file(Mapped_file&& other) noexcept
+    : m_data(std::exchange(other.m_data, nullptr)), m_size(std::exchange(other.m_size, 0)) {}
+
+  Mapped_file& operator=(Mapped_file&& other) noexcept {
+    std::swap(m_data, other.m_data);
+    std::swap(m_size, other.m_size);
+    return *this;
+  }
+
+  /* Map path, std::nullopt if it cannot be opened or mapped */
+  [[nodiscard]] static std::optional<Mapped_file> open(const std::string& path) {
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1) {
+      return std::nullopt;
+    }
+
+    auto file = map(fd);
+
+    if (file && file->m_data != nullptr) {
+      ::madvise(file->m_data, file->m_size, MADV_SEQUENTIAL);
+    }
+
+    const auto error = errno;
+    ::close(fd);
+    errno = error;
+
+    return file;
+  }
+
+  /* Map the whole of an open file, e.g. a memfd. The descriptor can be
+  closed afterwards. std::nullopt with errno set on failure. */
+  [[nodiscard]] static std::optional<Mapped_file> map(int fd) {
+    struct stat st {};
+
+    if (::fstat(fd, &st) != 0) {
+      return std::nullopt;
+    }
+
+    Mapped_file file;
+
+    /* An empty file has nothing to map */
+    if (st.st_size > 0) {
+      file.m_size = std::size_t(st.st_size);
+      file.m_data = ::mmap(nullptr, file.m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+      if (file.m_data == MAP_FAILED) {
+        file.m_data = nullptr;
+        file.m_size = 0;
+        return std::nullopt;
+      }
+    }
+    return file;
+  }
+
+  [[nodiscard]] std::string_view view() const noexcept {
+    return {static_cast<const char*>(m_data), m_size};
+  }
+
+private:
+  void* m_data{};
+  std::size_t m_size{};
+};
+
+/* Split the contents of a response file into arguments. Arguments are
+separated by whitespace. An argument that starts with a quote ('...' or
+"...") ends at the matching quote, may contain whitespace and is returned
+without the quotes. There are no escapes, so every argument is a view into
+text. */
+inline void split_response_file(std::string_view text, std::vector<std::string_view>& out) {
+  auto is_space = [](char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+  };
+
+  std::size_t pos{};
+
+  while (pos < text.size()) {
+    while (pos < text.size() && is_space(text[pos])) {
+      ++pos;
+    }
+
+    if (pos == text.size()) {
+      break;
+    }
+
+    if (text[pos] == '"' || text[pos] == '\'') {
+      const auto quote = text[pos++];
+      const auto end = std::min(text.find(quote, pos), text.size());
+
+      out.push_back(text.substr(pos, end - pos));
+      pos = end + 1;
+    } else {
+      const auto start = pos;
+
+      while (pos < text.size() && !is_space(text[pos])) {
+        ++pos;
+      }
+      out.push_back(text.substr(start, pos - start));
+    }
+  }
+}
+
+} // namespace cli
@@ -0,0 +1,233 @@
+#pragma once
+
+#include "cli/cli.h"
+
+namespace cli {
+
+/* Option declaration for a compile time schema, all fields are views of
+literals so that the whole schema can be constexpr. */
+struct Option_spec {
+  /* Short option name (e.g., 'v' for -v) */
+  std::string_view m_short_name{};
+
+  /* Long option name (e.g., 'verbose' for --verbose) */
+  std::string_view m_long_name{};
+
+  /* Help text description */
+  std::string_view m_description{};
+
+  /* Value_variant alternative of the option, see type_of<T> */
+  std::size_t m_type{};
+
+  /* Whether the option is required */
+  bool m_required{};
+
+  /* Default value in command line syntax (e.g. "8080" or "a=1,b=2") */
+  std::optional<std::string_view> m_default_value{};
+
+  /* Environment variable name */
+  std::optional<std::string_view> m_env_var{};
+
+  /* Name under which the option value is stored */
+  [[nodiscard]] constexpr std::string_view key() const noexcept {
+    return m_long_name.empty() ? m_short_name : m_long_name;
+  }
+};
+
+/* Seeded FNV-1a, short and long names hash differently */
+[[nodiscard]] constexpr std::uint64_t schema_hash(std::string_view name, bool is_short, std::uint64_t seed) noexcept {
+  std::uint64_t h = 14695981039346656037ULL ^ (seed * 0x9E3779B97F4A7C15ULL) ^ std::uint64_t(is_short);
+
+  for (auto c : name) {
+    h ^= std::uint8_t(c);
+    h *= 1099511628211ULL;
+  }
+  return h ^ (h >> 29);
+}
+
+/* Type erased view of a Schema, the schema it refers to must outlive it.
+A name is resolved with a minimal perfect hash: the first hash picks a
+bucket, the bucket seed picks the slot (or is the slot for buckets of one
+name), one compare rejects unknown names. */
+struct Schema_view {
+  struct Slot {
+    std::string_view m_name{};
+    bool m_is_short{};
+    std::uint32_t m_id{};
+  };
+
+  /* Seed flag of buckets holding a single name, the rest is the slot */
+  static constexpr std::uint32_t direct_slot = 1U << 31;
+
+  [[nodiscard]] constexpr std::optional<std::size_t> find(std::string_view name, bool is_short) const noexcept {
+    if (m_slots.empty()) {
+      return std::nullopt;
+    }
+
+    const auto n = m_slots.size();
+    const auto seed = m_seeds[schema_hash(name, is_short, 0) % n];
+    const auto& slot = m_slots[(seed & direct_slot) ? seed & ~direct_slot : schema_hash(name, is_short, seed) % n];
+
+    if (slot.m_is_short != is_short || slot.m_name != name) {
+      return std::nullopt;
+    }
+    return slot.m_id;
+  }
+
+  [[nodiscard]] constexpr bool empty() const noexcept {
+    return m_specs.empty();
+  }
+
+  std::span<const Option_spec> m_specs{};
+  std::span<const Slot> m_slots{};
+  std::span<const std::uint32_t> m_seeds{};
+};
+
+/* Not constexpr, calling it while building a schema is a compile error */
+inline void schema_error(const char*) {}
+
+/* Option set fixed at compile time:
+
+  constexpr cli::Schema schema{std::array{
+    cli::Option_spec{.m_short_name = "p", .m_long_name = "port", .m_type = cli::type_of<int>},
+    ...
+  }};
+
+The perfect hash is built by the consteval constructor, so the schema costs
+no startup work and no heap. */
+template<std::size_t N>
+struct Schema {
+  /* Short and long names */
+  static constexpr std::size_t max_names = 2 * N;
+
+  /* Seeds tried per bucket before giving up */
+  static constexpr std::uint32_t max_seed = 1U << 16;
+
+  consteval explicit Schema(const std::array<Option_spec, N>& specs)
+    : m_specs(specs) {
+    std::array<Schema_view::Slot, max_names> names{};
+
+    for (std::uint32_t id = 0; id < N; ++id) {
+      if (specs[id].m_short_name.empty() && specs[id].m_long_name.empty()) {
+        schema_error("Option must have either short or long name");
+      }
+      if (!specs[id].m_short_name.empty()) {
+        names[m_size++] = {specs[id].m_short_name, true, id};
+      }
+      if (!specs[id].m_long_name.empty()) {
+        names[m_size++] = {specs[id].m_long_name, false, id};
+      }
+    }
+
+    if (m_size == 0) {
+      return;
+    }
+
+    /* Bucket the names with the unseeded hash and group them by bucket */
+    std::array<std::size_t, max_names> bucket_of{};
+    std::array<std::size_t, max_names + 1> bucket_start{};
+    std::array<std::size_t, max_names> members{};
+    std::array<std::size_t, max_names> order{};
+
+    for (std::size_t i = 0; i < m_size; ++i) {
+      bucket_of[i] = schema_hash(names[i].m_name, names[i].m_is_short, 0) % m_size;
+      ++bucket_start[bucket_of[i] + 1];
+    }
+
+    for (std::size_t b = 0; b < m_size; ++b) {
+      bucket_start[b + 1] += bucket_start[b];
+      order[b] = b;
+    }
+
+    auto fill = bucket_start;
+
+    for (std::size_t i = 0; i < m_size; ++i) {
+      members[fill[bucket_of[i]]++] = i;
+    }
+
+    auto bucket_size = [&](std::size_t b) {
+      return bucket_start[b + 1] - bucket_start[b];
+    };
+
+    /* Place the largest buckets first, while most slots are free */
+    std::sort(order.begin(), order.begin() + m_size, [&](auto a, auto b) {
+      return bucket_size(a) > bucket_size(b);
+    });
+
+    std::array<bool, max_names> used{};
+    std::array<std::size_t, max_names> slots{};
+    std::size_t next_free{};
+
+    for (std::size_t i = 0; i < m_size && bucket_size(order[i]) > 0; ++i) {
+      const auto bucket = order[i];
+      const auto first = bucket_start[bucket];
+      const auto count = bucket_size(bucket);
+
+      if (count == 1) {
+        /* A single name goes straight into a free slot */
+        while (used[next_free]) {
+          ++next_free;
+        }
+        used[next_free] = true;
+        m_seeds[bucket] = Schema_view::direct_slot | std::uint32_t(next_free);
+        m_slots[next_free] = names[members[first]];
+        continue;
+      }
+
+      bool placed{};
+
+      for (std::uint32_t seed = 1; seed < max_seed && !placed; ++seed) {
+        placed = true;
+
+        for (std::size_t k = 0; k < count && placed; ++k) {
+          const auto& name = names[members[first + k]];
+
+          slots[k] = schema_hash(name.m_name, name.m_is_short, seed) % m_size;
+
+          if (used[slots[k]] || std::find(slots.begin(), slots.begin() + k, slots[k]) != slots.begin() + k) {
+            placed = false;
+          }
+        }
+
+        if (placed) {
+          m_seeds[bucket] = seed;
+
+          for (std::size_t k = 0; k < count; ++k) {
+            used[slots[k]] = true;
+            m_slots[slots[k]] = names[members[first + k]];
+          }
+        }
+      }
+
+      if (!placed) {
+        /* Also the case for duplicate names, they can never be separated */
+        schema_error("Duplicate option name or no perfect hash found");
+      }
+    }
+  }
+
+  [[nodiscard]] constexpr Schema_view view() const noexcept {
+    return Schema_view{
+      .m_specs = m_specs,
+      .m_slots = std::span(m_slots.data(), m_size),
+      .m_seeds = std::span(m_seeds.data(), m_size)
+    };
+  }
+
+  [[nodiscard]] constexpr std::optional<std::size_t> find(std::string_view name, bool is_short = false) const noexcept {
+    return view().find(name, is_short);
+  }
+
+  [[nodiscard]] constexpr const std::array<Option_spec, N>& specs() const noexcept {
+    return m_specs;
+  }
+
+  std::array<Option_spec, N> m_specs{};
+  std::array<Schema_view::Slot, max_names> m_slots{};
+  std::array<std::uint32_t, max_names> m_seeds{};
+
+  /* Number of names in the hash */
+  std::size_t m_size{};
+};
+
+} // namespace cli
@@ -0,0 +1,128 @@
+#pragma once
+
+#include "cli/cli.h"
+
+namespace cli {
+
+/* Immutable copy of the option values taken by Options::freeze(). Nothing
+in it changes after construction, so any number of threads can read it
+without synchronization. The value layers are shared with the options, which
+copy a layer before writing to it, so taking a snapshot copies one pointer
+per option and no values. */
+struct Options_snapshot {
+  /* Get option value by handle, nullptr if the option has no value */
+  template<Option_value T>
+  [[nodiscard]] const T* operator[](Option_handle<T> handle) const noexcept {
+    return m_values.template get<T>(handle.m_id, m_table->m_validators);
+  }
+
+  /* Get option value with type checking */
+  template<Option_value T>
+  [[nodiscard]] std::optional<T> get(std::string_view name) const {
+    if (auto id = find_value_id(m_schema, *m_table, name)) {
+      if (const auto* value = (*this)[Option_handle<T>{*id}]; value != nullptr) {
+        return *value;
+      }
+    }
+    return std::nullopt;
+  }
+
+  /* Check if option exists */
+  [[nodiscard]] bool has_value(std::string_view name) const {
+    auto id = find_value_id(m_schema, *m_table, name);
+    return id && m_values.has_value(*id, m_table->m_validators);
+  }
+
+  [[nodiscard]] const std::vector<std::string>& positional_args() const noexcept {
+    return m_positional_args;
+  }
+
+private:
+  friend struct Options;
+
+  template<std::size_t Capacity>
+  friend struct Overlay;
+
+  friend struct Options_image;
+
+  /* Keep the layers m_values points into alive */
+  std::array<std::shared_ptr<const Value_layer>, value_source_count> m_layers;
+  Value_table m_values;
+  std::vector<std::string> m_positional_args;
+  Schema_view m_schema{};
+  std::shared_ptr<const Option_table> m_table;
+
+  /* Buffers that std::string_view values may point into */
+  std::vector<std::shared_ptr<const void>> m_storage;
+};
+
+inline std::shared_ptr<const Options_snapshot> Options::freeze() const {
+  auto snapshot = std::make_shared<Options_snapshot>();
+
+  std::ranges::copy(m_layers, snapshot->m_layers.begin());
+  snapshot->m_values = m_values;
+  snapshot->m_positional_args = m_positional_args;
+  snapshot->m_schema = m_schema;
+  snapshot->m_table = m_table;
+  snapshot->m_storage = m_storage;
+
+  return snapshot;
+}
+
+/* Publishes snapshots to reader threads, RCU style. The writer swaps in a
+new snapshot with publish(), readers keep using the one they hold until
+they pick up the new one, and an old snapshot is freed when its last
+reader lets go of it. Readers never wait for the writer or each other. */
+struct Snapshot_publisher {
+  explicit Snapshot_publisher(std::shared_ptr<const Options_snapshot> snapshot)
+    : m_current(std::move(snapshot)) {}
+
+  Snapshot_publisher(const Snapshot_publisher&) = delete;
+  Snapshot_publisher& operator=(const Snapshot_publisher&) = delete;
+
+  /* Make snapshot the current one */
+  void publish(std::shared_ptr<const Options_snapshot> snapshot) {
+    m_current.store(std::move(snapshot), std::memory_order_release);
+    m_version.fetch_add(1, std::memory_order_release);
+  }
+
+  [[nodiscard]] std::shared_ptr<const Options_snapshot> load() const {
+    return m_current.load(std::memory_order_acquire);
+  }
+
+  /* Incremented by every publish() */
+  [[nodiscard]] std::uint64_t version() const noexcept {
+    return m_version.load(std::memory_order_acquire);
+  }
+
+  /* Per thread reader. get() only loads the version counter, which is
+  written once per publish, so reads do not bounce any cache line between
+  threads. The snapshot is reloaded when the version has changed. */
+  struct Reader {
+    explicit Reader(const Snapshot_publisher& publisher)
+      : m_publisher(publisher),
+        m_version(publisher.version()),
+        m_snapshot(publisher.load()) {}
+
+    [[nodiscard]] const Options_snapshot& get() {
+      if (const auto version = m_publisher.version(); version != m_version) {
+        m_snapshot = m_publisher.load();
+        m_version = version;
+      }
+      return *m_snapshot;
+    }
+
+  private:
+    const Snapshot_publisher& m_publisher;
+    std::uint64_t m_version{};
+    std::shared_ptr<const Options_snapshot> m_snapshot;
+  };
+
+private:
+  /* Read by every reader on every get(), kept apart from m_current */
+  alignas(64) std::atomic<std::uint64_t> m_version{};
+
+  alignas(64) std::atomic<std::shared_ptr<const Options_snapshot>> m_current;
+};
+
+} // namespace cli
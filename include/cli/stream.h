@@ -0,0 +1,76 @@
+#pragma once
+
+#include "cli/cli.h"
+
+#include <unistd.h>
+
+namespace cli {
+
+/* Read items separated by delimiter from fd and pass each one to callback.
+The data goes through a single buffer that only grows when one item does
+not fit, so memory use does not depend on the number of items. The view
+passed to callback is only valid during the call. Empty items are skipped,
+the last item does not need a trailing delimiter. Returns the number of
+items read, or errno on a read error. */
+inline std::expected<std::size_t, int> read_delimited(
+    int fd,
+    char delimiter,
+    const std::function<void(std::string_view)>& callback,
+    std::size_t buffer_size = 64 * 1024) {
+
+  std::vector<char> buffer(std::max<std::size_t>(buffer_size, 1));
+
+  /* Start of the current item, end of the data and end of the scanned data */
+  std::size_t begin{};
+  std::size_t end{};
+  std::size_t scan{};
+  std::size_t count{};
+
+  auto emit = [&](std::string_view item) {
+    if (!item.empty()) {
+      callback(item);
+      ++count;
+    }
+  };
+
+  for (;;) {
+    if (end == buffer.size()) {
+      if (begin > 0) {
+        /* Move the partial item to the front */
+        std::memmove(buffer.data(), buffer.data() + begin, end - begin);
+        end -= begin;
+        scan -= begin;
+        begin = 0;
+      } else {
+        buffer.resize(buffer.size() * 2);
+      }
+    }
+
+    const auto n = ::read(fd, buffer.data() + end, buffer.size() - end);
+
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return std::unexpected(errno);
+    } else if (n == 0) {
+      break;
+    }
+
+    end += std::size_t(n);
+
+    const std::string_view data(buffer.data(), end);
+
+    for (auto pos = find_byte(data, delimiter, scan); pos != std::string_view::npos; pos = find_byte(data, delimiter, scan)) {
+      emit(data.substr(begin, pos - begin));
+      begin = scan = pos + 1;
+    }
+    scan = end;
+  }
+
+  emit(std::string_view(buffer.data() + begin, end - begin));
+
+  return count;
+}
+
+} // namespace cli
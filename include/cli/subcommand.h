@@ -0,0 +1,185 @@
+#pragma once
+
+#include "cli/cli.h"
+
+namespace cli {
+
+/* Options of the command selected by Subcommands::try_parse() */
+struct Command {
+  /* Name of the command, a view into the registry that stays valid until
+  the next add() */
+  std::string_view m_name{};
+
+  Options m_options;
+
+  Parse_result m_result{};
+};
+
+/* Registry of subcommands for tools with several modes, e.g.
+"tool serve --port=80" and "tool check --strict". Each command registers a
+factory that builds its options:
+
+  cli::Subcommands commands;
+  cli::Option_handle<int> port;
+
+  commands.add("serve", "Run the server", [&] {
+    cli::Options options;
+    port = options.add_option<int>({.m_long_name = "port", .m_default_value = 80});
+    return options;
+  });
+
+  auto command = commands.parse(argc, argv);
+
+Only the factory of the command named by the first argument runs, so
+option setup, environment lookups and default parsing of the other commands
+cost nothing. The command is found with one hash lookup. The arguments after
+the command name are parsed by its options. */
+struct Subcommands {
+  /* Builds the options of a command, called once per parse of that command */
+  using Factory = std::function<Options()>;
+
+  /* Register a command, the name must not be empty or taken */
+  inline void add(std::string name, std::string description, Factory factory);
+
+  [[nodiscard]] bool contains(std::string_view name) const {
+    return m_index.contains(name);
+  }
+
+  /* Number of commands */
+  [[nodiscard]] std::size_t size() const noexcept {
+    return m_commands.size();
+  }
+
+  /* Select the command named by argv[1] and parse the rest of argv with its
+  options. argv must outlive the returned options. */
+  [[nodiscard]] inline std::expected<Command, std::vector<Diagnostic>> try_parse(int argc, char* argv[]) const;
+
+  /* Same for arguments without the program name, args[0] is the command */
+  [[nodiscard]] inline std::expected<Command, std::vector<Diagnostic>> try_parse(std::span<const std::string_view> args) const;
+
+  /* try_parse() that logs the diagnostics */
+  [[nodiscard]] inline std::optional<Command> parse(int argc, char* argv[]) const;
+
+  /* Print the commands, sorted by name */
+  inline void print_help(std::string_view program_name) const;
+
+private:
+  friend struct Completion_index;
+
+  struct Entry {
+    std::string m_name;
+    std::string m_description;
+    Factory m_factory;
+  };
+
+  /* Look up the command and build its options */
+  [[nodiscard]] inline std::expected<Command, std::vector<Diagnostic>> select(std::optional<std::string_view> name) const;
+
+  /* Command with the result of parsing its arguments */
+  [[nodiscard]] static inline std::expected<Command, std::vector<Diagnostic>> finish(Command command, std::expected<Parse_result, std::vector<Diagnostic>> result);
+
+  /* Commands in registration order */
+  std::vector<Entry> m_commands;
+
+  /* Index into m_commands by name */
+  String_map<std::size_t> m_index;
+};
+
+inline void Subcommands::add(std::string name, std::string description, Factory factory) {
+  if (name.empty() || name.starts_with('-')) {
+    throw_error<Option_error>(std::format("Invalid command name '{}'", name));
+  }
+
+  if (m_index.contains(name)) {
+    throw_error<Option_error>(std::format("Command '{}' already exists", name));
+  }
+
+  m_index.emplace(name, m_commands.size());
+  m_commands.push_back({.m_name = std::move(name), .m_description = std::move(description), .m_factory = std::move(factory)});
+}
+
+inline std::expected<Command, std::vector<Diagnostic>> Subcommands::select(std::optional<std::string_view> name) const {
+  if (!name) {
+    return std::unexpected(std::vector{Diagnostic{.m_code = Diagnostic_code::missing_command, .m_arg_index = 1}});
+  }
+
+  const auto it = m_index.find(*name);
+
+  if (it == m_index.end()) {
+    return std::unexpected(std::vector{Diagnostic{.m_code = Diagnostic_code::unknown_command, .m_option = std::string(*name), .m_arg_index = 1}});
+  }
+
+  const auto& entry = m_commands[it->second];
+
+  return Command{.m_name = entry.m_name, .m_options = entry.m_factory()};
+}
+
+inline std::expected<Command, std::vector<Diagnostic>> Subcommands::try_parse(int argc, char* argv[]) const {
+  auto command = select(argc > 1 ? std::optional<std::string_view>(argv[1]) : std::nullopt);
+
+  if (!command) {
+    return command;
+  }
+
+  /* The command name takes the place of the program name */
+  return finish(std::move(*command), command->m_options.try_parse(argc - 1, argv + 1));
+}
+
+inline std::expected<Command, std::vector<Diagnostic>> Subcommands::try_parse(std::span<const std::string_view> args) const {
+  auto command = select(args.empty() ? std::nullopt : std::optional<std::string_view>(args.front()));
+
+  if (!command) {
+    return command;
+  }
+
+  return finish(std::move(*command), command->m_options.try_parse(args.subspan(1)));
+}
+
+inline std::expected<Command, std::vector<Diagnostic>> Subcommands::finish(Command command, std::expected<Parse_result, std::vector<Diagnostic>> result) {
+  if (!result) {
+    /* The options counted from the command name, make the positions
+    relative to argv like the ones of select() */
+    for (auto& diagnostic : result.error()) {
+      if (diagnostic.m_arg_index != 0) {
+        ++diagnostic.m_arg_index;
+      }
+    }
+    return std::unexpected(std::move(result.error()));
+  }
+  command.m_result = *result;
+  return command;
+}
+
+inline std::optional<Command> Subcommands::parse(int argc, char* argv[]) const {
+  auto result = try_parse(argc, argv);
+
+  if (!result) {
+    for (const auto& diagnostic : result.error()) {
+      log_error(diagnostic.to_string());
+    }
+    return std::nullopt;
+  }
+  return std::move(*result);
+}
+
+inline void Subcommands::print_help(std::string_view program_name) const {
+  log_info("Usage: ", program_name, " <COMMAND> [OPTIONS] [ARGUMENTS]");
+  log_info("Commands:");
+
+  std::vector<const Entry*> entries;
+  entries.reserve(m_commands.size());
+
+  for (const auto& entry : m_commands) {
+    entries.push_back(&entry);
+  }
+
+  std::ranges::sort(entries, [](const auto* a, const auto* b) {
+    return a->m_name < b->m_name;
+  });
+
+  for (const auto* entry : entries) {
+    log_info(std::format("  {:<48} {}", entry->m_name, entry->m_description));
+  }
+}
+
+} // namespace cli
@@ -0,0 +1,143 @@
+#pragma once
+
+#include "cli/cli.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace cli {
+
+/* Delimiter scanning for collection values. Bytes are compared a block at a
+time and the matches are returned as a bit mask, bit i set if p[i] == c. */
+#if defined(__AVX2__)
+inline constexpr std::size_t scan_block_size = 32;
+#elif defined(__SSE2__)
+inline constexpr std::size_t scan_block_size = 16;
+#else
+inline constexpr std::size_t scan_block_size = 8;
+#endif
+
+[[nodiscard]] inline std::uint32_t match_mask(const char* p, std::size_t n, char c) noexcept {
+  if (n == scan_block_size) {
+#if defined(__AVX2__)
+    const auto block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    return static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, _mm256_set1_epi8(c))));
+#elif defined(__SSE2__)
+    const auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    return static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_set1_epi8(c))));
+#endif
+  }
+
+  /* Tail of the input, or no SIMD support */
+  std::uint32_t mask{};
+
+  for (std::size_t i = 0; i < n; ++i) {
+    mask |= static_cast<std::uint32_t>(p[i] == c) << i;
+  }
+  return mask;
+}
+
+/* Position of the first c in value at or after pos, npos if there is none */
+[[nodiscard]] inline std::size_t find_byte(std::string_view value, char c, std::size_t pos = 0) noexcept {
+  for (; pos < value.size(); pos += scan_block_size) {
+    const auto n = std::min(scan_block_size, value.size() - pos);
+
+    if (const auto mask = match_mask(value.data() + pos, n, c); mask != 0) {
+      return pos + std::countr_zero(mask);
+    }
+  }
+  return std::string_view::npos;
+}
+
+/* Number of occurrences of c in value */
+[[nodiscard]] inline std::size_t count_byte(std::string_view value, char c) noexcept {
+  std::size_t count{};
+
+  for (std::size_t pos = 0; pos < value.size(); pos += scan_block_size) {
+    count += std::popcount(match_mask(value.data() + pos, std::min(scan_block_size, value.size() - pos), c));
+  }
+  return count;
+}
+
+/* Strip leading and trailing blanks without copying */
+[[nodiscard]] inline std::string_view trim(std::string_view value) noexcept {
+  const auto first = value.find_first_not_of(" \t");
+
+  if (first == std::string_view::npos) {
+    return {};
+  }
+  return value.substr(first, value.find_last_not_of(" \t") - first + 1);
+}
+
+/* Splits a delimited list into trimmed views of the input. The delimiters
+are found one block at a time and consumed from the block mask, so the
+input is scanned once. Like std::getline a trailing delimiter does not
+produce an empty last token. */
+struct Tokenizer {
+  explicit Tokenizer(std::string_view input, char delimiter = ',') noexcept
+    : m_input(input), m_delimiter(delimiter) {}
+
+  /* Upper bound on the number of tokens, used to presize the output */
+  [[nodiscard]] std::size_t count() const noexcept {
+    return m_input.empty() ? 0 : count_byte(m_input, m_delimiter) + 1;
+  }
+
+  /* Next token, std::nullopt once the input is exhausted */
+  [[nodiscard]] std::optional<std::string_view> next() noexcept {
+    while (m_mask == 0) {
+      if (m_block >= m_input.size()) {
+        if (m_start >= m_input.size()) {
+          return std::nullopt;
+        }
+        const auto token = m_input.substr(m_start);
+        m_start = m_input.size();
+        return trim(token);
+      }
+
+      m_base = m_block;
+      m_mask = match_mask(m_input.data() + m_block, std::min(scan_block_size, m_input.size() - m_block), m_delimiter);
+      m_block += scan_block_size;
+    }
+
+    const auto end = m_base + std::countr_zero(m_mask);
+    const auto token = m_input.substr(m_start, end - m_start);
+
+    m_mask &= m_mask - 1;
+    m_start = end + 1;
+
+    return trim(token);
+  }
+
+private:
+  std::string_view m_input;
+  char m_delimiter{};
+
+  /* Start of the next token */
+  std::size_t m_start{};
+
+  /* Next block to scan */
+  std::size_t m_block{};
+
+  /* Offset of the block m_mask was computed from */
+  std::size_t m_base{};
+
+  /* Unconsumed delimiter positions in the current block */
+  std::uint32_t m_mask{};
+};
+
+/* Convert a single collection element */
+template<typename T>
+[[nodiscard]] inline std::optional<T> convert_token(std::string_view token) {
+  if constexpr (std::same_as<T, int> || std::same_as<T, double>) {
+    return parse_number<T>(token);
+  } else if constexpr (std::same_as<T, bool>) {
+    return is_true(token);
+  } else {
+    return T(token);
+  }
+}
+
+} // namespace cli
@@ -1,4 +1,8 @@
 #include <gtest/gtest.h>
+#include <filesystem>
+#include <fstream>
+#include <memory_resource>
+#include <thread>
 #include "cli/cli.h"
 
 class Array_value_test : public ::testing::Test {
@@ -57,6 +61,46 @@ TEST_F(Array_value_test, ToString) {
   EXPECT_EQ(str_arr.to_string(), "a,b,c");
 }
 
+TEST_F(Array_value_test, ParseLongArray) {
+  std::string input;
+
+  /* Long enough to cross several scan blocks, with uneven token widths */
+  for (int i = 0; i < 1000; ++i) {
+    input += (i == 0 ? "" : (i % 3 == 0 ? " , " : ",")) + std::to_string(i * 7);
+  }
+
+  auto result = cli::Array_value<int>::parse(input);
+  ASSERT_TRUE(result.has_value());
+  ASSERT_EQ(result->size(), 1000);
+
+  for (int i = 0; i < 1000; ++i) {
+    EXPECT_EQ((*result)[i], i * 7);
+  }
+}
+
+TEST_F(Array_value_test, ParseRejectsTrailingGarbage) {
+  EXPECT_FALSE(cli::Array_value<int>::parse("1,2x,3").has_value());
+  EXPECT_FALSE(cli::Array_value<double>::parse("1.5,,2.5").has_value());
+
+  auto result = cli::Array_value<int>::parse("+1,-2,3,");
+  ASSERT_TRUE(result.has_value());
+  EXPECT_EQ(result->values(), std::vector<int>({1, -2, 3}));
+}
+
+TEST(Tokenizer_test, Tokens) {
+  cli::Tokenizer tokens(" a ,b,, c\t,");
+
+  EXPECT_EQ(tokens.count(), 5);
+  EXPECT_EQ(tokens.next(), "a");
+  EXPECT_EQ(tokens.next(), "b");
+  EXPECT_EQ(tokens.next(), "");
+  EXPECT_EQ(tokens.next(), "c");
+  EXPECT_EQ(tokens.next(), std::nullopt);
+
+  EXPECT_EQ(cli::find_byte(std::string(100, 'x') + "=", '='), 100);
+  EXPECT_EQ(cli::count_byte(std::string(77, ','), ','), 77);
+}
+
 class Map_value_test : public ::testing::Test {
 protected:
   void SetUp() override {}
@@ -95,6 +139,1467 @@ TEST_F(Map_value_test, InvalidInput) {
   EXPECT_FALSE(result.has_value());
 }
 
+TEST_F(Map_value_test, StoragePolicies) {
+  using Flat = cli::Map_value<std::string, int, cli::Flat_map>;
+  using Hash = cli::Map_value<std::string, int, cli::Hash_map>;
+
+  /* The last of equal keys wins, like for the default policy */
+  auto flat = Flat::parse("c=3,a=1,b=2,a=4");
+  auto hash = Hash::parse("c=3,a=1,b=2,a=4");
+
+  ASSERT_TRUE(flat && hash);
+  EXPECT_EQ(flat->size(), 3);
+  EXPECT_EQ(flat->at("a"), 4);
+  EXPECT_EQ(flat->to_string(), "{a=4},{b=2},{c=3}");
+  EXPECT_EQ(hash->size(), 3);
+  EXPECT_EQ(hash->at("a"), 4);
+  EXPECT_EQ(hash->to_string(), "{c=3},{a=4},{b=2}");
+  EXPECT_FALSE(Hash::parse("a=x"));
+
+  /* Equality ignores the order of a hash map */
+  EXPECT_EQ(*hash, Hash({{"a", 4}, {"b", 2}, {"c", 3}}));
+  EXPECT_NE(*hash, Hash({{"a", 4}, {"b", 2}}));
+
+  (*flat)["b"] = 5;
+  (*hash)["d"] = 6;
+  flat->insert_or_assign("a", 7);
+  EXPECT_EQ(flat->at("b"), 5);
+  EXPECT_EQ(hash->at("d"), 6);
+  EXPECT_EQ(flat->at("a"), 7);
+
+  /* Keys cannot be changed through iteration or find(), for every policy */
+  static_assert(std::is_const_v<std::remove_reference_t<decltype(*flat->values().find("a"))>>);
+  static_assert(std::is_const_v<std::remove_reference_t<decltype(*hash->begin())>>);
+  static_assert(std::is_const_v<std::remove_reference_t<decltype(*hash->values().find("a"))>>);
+  static_assert(!std::is_assignable_v<decltype((flat->begin()->first)), std::string>);
+  static_assert(!std::is_assignable_v<decltype((hash->begin()->first)), std::string>);
+  static_assert(!std::is_assignable_v<decltype((cli::Map_value<std::string, int>().begin()->first)), std::string>);
+  EXPECT_FALSE(hash->values().contains("e"));
+
+  /* Conversion from the policy options are stored with */
+  cli::Map_value<std::string, int> tree({{"x", 1}, {"y", 2}});
+  EXPECT_EQ(Flat(tree), Flat({{"y", 2}, {"x", 1}}));
+  EXPECT_EQ(Hash(tree).at("y"), 2);
+}
+
+TEST_F(Map_value_test, HashMapGrowth) {
+  cli::Hash_map<std::string, int> map;
+
+  for (int i = 0; i < 10'000; ++i) {
+    map.insert_or_assign(std::to_string(i), i);
+  }
+
+  EXPECT_EQ(map.size(), 10'000);
+  for (int i = 0; i < 10'000; ++i) {
+    ASSERT_EQ(map.at(std::to_string(i)), i);
+  }
+  EXPECT_EQ(map.find("10000"), map.end());
+}
+
+/* Counts the allocations it passes on to new and delete */
+struct Counting_resource : std::pmr::memory_resource {
+  std::size_t m_allocations{};
+
+private:
+  void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+    ++m_allocations;
+    return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+  }
+
+  void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override {
+    std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+  }
+
+  bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+    return this == &other;
+  }
+};
+
+TEST_F(Map_value_test, MemoryResource) {
+  Counting_resource resource;
+  std::pmr::polymorphic_allocator<> alloc(&resource);
+
+  auto hosts = cli::Pmr_array_value<std::pmr::string>::parse("alpha.example.com,beta.example.com", alloc);
+  ASSERT_TRUE(hosts);
+  EXPECT_EQ((*hosts)[1], "beta.example.com");
+  EXPECT_EQ((*hosts)[1].get_allocator().resource(), &resource);
+
+  using Limits = cli::Map_value<std::pmr::string, int, cli::Pmr_map>;
+
+  auto limits = Limits::parse("connections-per-host=2,memory=512,connections-per-host=4", alloc);
+  ASSERT_TRUE(limits);
+  EXPECT_EQ(limits->at("connections-per-host"), 4);
+  EXPECT_EQ(limits->values().get_allocator().resource(), &resource);
+  EXPECT_EQ(limits->begin()->first.get_allocator().resource(), &resource);
+
+  /* Invalid elements fail like with the default allocator */
+  EXPECT_FALSE(cli::Pmr_array_value<int>::parse("1,x", alloc));
+  EXPECT_GT(resource.m_allocations, 0);
+}
+
+class Options_test : public ::testing::Test {
+protected:
+  void SetUp() override {}
+
+  cli::Options m_options;
+};
+
+TEST_F(Options_test, HandleAccess) {
+  auto port = m_options.add_option<int>({
+    .m_short_name = "p",
+    .m_long_name = "port",
+    .m_description = "Port number",
+    .m_default_value = 8080
+  });
+
+  auto host = m_options.add_option<std::string>({
+    .m_long_name = "host",
+    .m_description = "Host address"
+  });
+
+  ASSERT_TRUE(port.valid());
+  ASSERT_NE(m_options[port], nullptr);
+  EXPECT_EQ(*m_options[port], 8080);
+  EXPECT_EQ(m_options[host], nullptr);
+
+  const char* argv[] = {"program", "-p", "9090", "--host=example.com"};
+  ASSERT_TRUE(m_options.parse(4, const_cast<char**>(argv)));
+
+  EXPECT_EQ(*m_options[port], 9090);
+  ASSERT_NE(m_options[host], nullptr);
+  EXPECT_EQ(*m_options[host], "example.com");
+  EXPECT_EQ(m_options.get<int>("port"), 9090);
+}
+
+TEST_F(Options_test, InvalidHandle) {
+  cli::Option_handle<int> handle;
+
+  EXPECT_FALSE(handle.valid());
+  EXPECT_EQ(m_options[handle], nullptr);
+}
+
+TEST_F(Options_test, StringViewValues) {
+  auto name = m_options.add_option<std::string_view>({
+    .m_long_name = "name",
+    .m_description = "Borrowed name"
+  });
+
+  auto owned = m_options.add_option<std::string>({
+    .m_long_name = "owned",
+    .m_description = "Owned name"
+  });
+
+  char name_arg[] = "--name=borrowed";
+  char owned_arg[] = "--owned=copied";
+  char* argv[] = {const_cast<char*>("program"), name_arg, owned_arg};
+  ASSERT_TRUE(m_options.parse(3, argv));
+
+  ASSERT_NE(m_options[name], nullptr);
+  EXPECT_EQ(*m_options[name], "borrowed");
+
+  /* The view points into argv, the string is a copy */
+  EXPECT_EQ(m_options[name]->data(), name_arg + 7);
+  ASSERT_NE(m_options[owned], nullptr);
+  EXPECT_NE(m_options[owned]->data(), owned_arg + 8);
+}
+
+TEST_F(Options_test, ValidationSeesTypedValue) {
+  m_options.add_option<int>({
+    .m_long_name = "port",
+    .m_description = "Port number",
+    .m_default_value = 8080
+  });
+
+  m_options.add_validation("port", [](const cli::Value_variant& value) {
+    auto port = std::get<int>(value);
+    return port >= 1024 && port <= 65535;
+  });
+
+  const char* ok[] = {"program", "--port", "9090"};
+  EXPECT_TRUE(m_options.parse(3, const_cast<char**>(ok)));
+  EXPECT_EQ(m_options.get<int>("port"), 9090);
+
+  const char* bad[] = {"program", "--port", "80"};
+  EXPECT_FALSE(m_options.parse(3, const_cast<char**>(bad)));
+  EXPECT_EQ(m_options.get<int>("port"), 9090);
+}
+
+TEST_F(Options_test, TryParseCollectsDiagnostics) {
+  m_options.add_option<int>({
+    .m_long_name = "port",
+    .m_description = "Port number",
+    .m_required = true
+  });
+
+  m_options.add_option<bool>({
+    .m_short_name = "v",
+    .m_long_name = "verbose",
+    .m_description = "Verbose output"
+  });
+
+  const char* argv[] = {"program", "--bogus", "-v", "maybe", "file"};
+  auto result = m_options.try_parse(5, const_cast<char**>(argv));
+
+  ASSERT_FALSE(result.has_value());
+
+  const auto& diagnostics = result.error();
+  ASSERT_EQ(diagnostics.size(), 3);
+
+  EXPECT_EQ(diagnostics[0].m_code, cli::Diagnostic_code::unknown_option);
+  EXPECT_EQ(diagnostics[0].m_option, "bogus");
+  EXPECT_EQ(diagnostics[0].m_arg_index, 1);
+
+  EXPECT_EQ(diagnostics[1].m_code, cli::Diagnostic_code::invalid_value);
+  EXPECT_EQ(diagnostics[1].m_option, "v");
+  EXPECT_EQ(diagnostics[1].m_value, "maybe");
+  EXPECT_EQ(diagnostics[1].m_arg_index, 2);
+
+  EXPECT_EQ(diagnostics[2].m_code, cli::Diagnostic_code::missing_required);
+  EXPECT_EQ(diagnostics[2].m_option, "port");
+}
+
+TEST_F(Options_test, TryParseResult) {
+  m_options.add_option<int>({
+    .m_long_name = "port",
+    .m_description = "Port number"
+  });
+
+  const char* argv[] = {"program", "--port=80", "a", "b"};
+  auto result = m_options.try_parse(4, const_cast<char**>(argv));
+
+  ASSERT_TRUE(result.has_value());
+  EXPECT_EQ(result->m_options_set, 1);
+  EXPECT_EQ(result->m_positional_count, 2);
+}
+
+constexpr cli::Schema test_schema{std::array{
+  cli::Option_spec{
+    .m_short_name = "v",
+    .m_long_name = "verbose",
+    .m_description = "Enable verbose output",
+    .m_type = cli::type_of<bool>
+  },
+  cli::Option_spec{
+    .m_short_name = "p",
+    .m_long_name = "port",
+    .m_description = "Port number",
+    .m_type = cli::type_of<int>,
+    .m_default_value = "8080"
+  },
+  cli::Option_spec{
+    .m_long_name = "host",
+    .m_description = "Host address",
+    .m_type = cli::type_of<std::string_view>,
+    .m_required = true
+  },
+  cli::Option_spec{
+    .m_long_name = "limits",
+    .m_description = "Resource limits",
+    .m_type = cli::type_of<cli::Map_value<std::string, int>>
+  }
+}};
+
+static_assert(test_schema.find("port") == 1);
+static_assert(test_schema.find("p", true) == 1);
+static_assert(test_schema.find("limits") == 3);
+static_assert(!test_schema.find("p"));
+static_assert(!test_schema.find("bogus"));
+
+TEST(Schema_test, Parse) {
+  cli::Options options(test_schema);
+
+  constexpr auto port = cli::make_handle<int>(test_schema, "port");
+  constexpr auto host = cli::make_handle<std::string_view>(test_schema, "host");
+  constexpr auto limits = cli::make_handle<cli::Map_value<std::string, int>>(test_schema, "limits");
+
+  ASSERT_NE(options[port], nullptr);
+  EXPECT_EQ(*options[port], 8080);
+
+  const char* argv[] = {"program", "-p", "9090", "--host", "example.com", "--limits=cpu=2"};
+  ASSERT_TRUE(options.parse(6, const_cast<char**>(argv)));
+
+  EXPECT_EQ(*options[port], 9090);
+  EXPECT_EQ(*options[host], "example.com");
+  EXPECT_EQ(options[limits]->at("cpu"), 2);
+  EXPECT_EQ(options.get<int>("port"), 9090);
+  EXPECT_FALSE(options.has_value("verbose"));
+}
+
+TEST(Schema_test, Diagnostics) {
+  cli::Options options(test_schema);
+
+  const char* argv[] = {"program", "--bogus", "-p", "x"};
+  auto result = options.try_parse(4, const_cast<char**>(argv));
+
+  ASSERT_FALSE(result.has_value());
+  ASSERT_EQ(result.error().size(), 3);
+  EXPECT_EQ(result.error()[0].m_code, cli::Diagnostic_code::unknown_option);
+  EXPECT_EQ(result.error()[1].m_code, cli::Diagnostic_code::invalid_value);
+  EXPECT_EQ(result.error()[2].m_code, cli::Diagnostic_code::missing_required);
+  EXPECT_EQ(result.error()[2].m_option, "host");
+}
+
+struct Test_config {
+  int m_port{};
+  bool m_verbose{};
+  std::string m_host{};
+  cli::Array_value<int> m_ids{};
+};
+
+TEST_F(Options_test, BindStruct) {
+  Test_config config;
+  cli::Binder binder(m_options, config);
+
+  binder.bind(&Test_config::m_port, {
+    .m_short_name = "p",
+    .m_long_name = "port",
+    .m_description = "Port number",
+    .m_default_value = 8080
+  });
+
+  binder.bind(&Test_config::m_verbose, {.m_long_name = "verbose", .m_description = "Verbose output"});
+  binder.bind(&Test_config::m_host, {.m_long_name = "host", .m_description = "Host address"});
+  binder.bind(&Test_config::m_ids, {.m_long_name = "ids", .m_description = "Identifiers"});
+
+  /* The default is written when the option is bound */
+  EXPECT_EQ(config.m_port, 8080);
+
+  const char* argv[] = {"program", "-p", "9090", "--verbose", "--host=example.com", "--ids=1,2,3"};
+  ASSERT_TRUE(m_options.parse(6, const_cast<char**>(argv)));
+
+  EXPECT_EQ(config.m_port, 9090);
+  EXPECT_TRUE(config.m_verbose);
+  EXPECT_EQ(config.m_host, "example.com");
+  EXPECT_EQ(config.m_ids.values(), std::vector<int>({1, 2, 3}));
+}
+
+TEST_F(Options_test, OnChange) {
+  auto port = m_options.add_option<int>({.m_long_name = "port", .m_description = "Port number"});
+  std::vector<int> seen;
+
+  m_options.on_change(port, [&seen](const int& value) { seen.push_back(value); });
+
+  const char* argv[] = {"program", "--port=1", "--port=x", "--port=2"};
+  EXPECT_FALSE(m_options.parse(4, const_cast<char**>(argv)));
+  EXPECT_EQ(seen, std::vector<int>({1, 2}));
+}
+
+/* Options with a scratch directory for files the test writes */
+class Temp_dir_test : public Options_test {
+protected:
+  void SetUp() override {
+    m_dir = std::filesystem::temp_directory_path() / std::format("cli_tests_{}", ::getpid());
+    std::filesystem::create_directories(m_dir);
+  }
+
+  void TearDown() override {
+    std::filesystem::remove_all(m_dir);
+  }
+
+  std::string write(const std::string& name, const std::string& contents) {
+    auto path = m_dir / name;
+    std::ofstream(path) << contents;
+    return path.string();
+  }
+
+  std::filesystem::path m_dir;
+};
+
+class Response_file_test : public Temp_dir_test {};
+
+TEST_F(Response_file_test, Expand) {
+  auto port = m_options.add_option<int>({.m_long_name = "port", .m_description = "Port number"});
+  auto name = m_options.add_option<std::string_view>({.m_long_name = "name", .m_description = "Name"});
+
+  auto inner = write("inner.rsp", "shard-2\n'shard 3'\n");
+  auto outer = write("outer.rsp", std::format("--port 9090\n\"--name=job one\" shard-1 @{}", inner));
+  auto arg = "@" + outer;
+
+  m_options.enable_response_files();
+
+  const char* argv[] = {"program", arg.c_str(), "shard-4"};
+  auto result = m_options.try_parse(3, const_cast<char**>(argv));
+
+  ASSERT_TRUE(result.has_value());
+  EXPECT_EQ(*m_options[port], 9090);
+  EXPECT_EQ(*m_options[name], "job one");
+  EXPECT_EQ(m_options.positional_args(), std::vector<std::string>({"shard-1", "shard-2", "shard 3", "shard-4"}));
+}
+
+TEST_F(Response_file_test, Errors) {
+  auto loop = write("loop.rsp", "");
+  write("loop.rsp", "@" + loop);
+
+  m_options.enable_response_files();
+
+  auto missing = "@" + (m_dir / "missing.rsp").string();
+  auto looping = "@" + loop;
+
+  const char* argv[] = {"program", missing.c_str(), looping.c_str()};
+  auto result = m_options.try_parse(3, const_cast<char**>(argv));
+
+  ASSERT_FALSE(result.has_value());
+  ASSERT_EQ(result.error().size(), 2);
+  EXPECT_EQ(result.error()[0].m_code, cli::Diagnostic_code::bad_response_file);
+  EXPECT_EQ(result.error()[1].m_code, cli::Diagnostic_code::bad_response_file);
+  EXPECT_EQ(result.error()[1].m_value, "nested too deeply");
+}
+
+TEST_F(Response_file_test, Reparse) {
+  auto name = m_options.add_option<std::string_view>({.m_long_name = "name", .m_description = "Name"});
+  auto arg = "@" + write("args.rsp", "--name=first");
+
+  m_options.enable_response_files();
+
+  const char* argv[] = {"program", arg.c_str()};
+
+  /* An unchanged file is mapped once, also for derived options */
+  for (int i = 0; i < 10; ++i) {
+    ASSERT_TRUE(m_options.try_parse(2, const_cast<char**>(argv)).has_value());
+    auto derived = m_options.derive();
+    ASSERT_TRUE(derived.try_parse(2, const_cast<char**>(argv)).has_value());
+    EXPECT_EQ(derived.retained(), 1);
+  }
+  EXPECT_EQ(m_options.retained(), 1);
+  EXPECT_EQ(*m_options[name], "first");
+
+  /* A replaced file is mapped again, the old mapping stays for the values
+  that point into it until the argv layer is reset */
+  std::filesystem::rename(write("next.rsp", "--name=second"), arg.substr(1));
+  auto snapshot = m_options.freeze();
+
+  ASSERT_TRUE(m_options.try_parse(2, const_cast<char**>(argv)).has_value());
+  EXPECT_EQ(m_options.retained(), 2);
+  EXPECT_EQ(*m_options[name], "second");
+  EXPECT_EQ(*(*snapshot)[name], "first");
+
+  m_options.reset(cli::Value_source::argv);
+  EXPECT_EQ(m_options.retained(), 0);
+  EXPECT_EQ(m_options[name], nullptr);
+  EXPECT_EQ(*(*snapshot)[name], "first");
+}
+
+TEST_F(Response_file_test, Disabled) {
+  const char* argv[] = {"program", "@user"};
+  ASSERT_TRUE(m_options.parse(2, const_cast<char**>(argv)));
+  EXPECT_EQ(m_options.positional_args(), std::vector<std::string>({"@user"}));
+}
+
+TEST_F(Options_test, PositionalCallback) {
+  std::vector<std::string> seen;
+
+  m_options.add_option<bool>({.m_short_name = "v", .m_description = "Verbose output"});
+  m_options.on_positional([&seen](std::string_view arg) { seen.emplace_back(arg); });
+
+  const char* argv[] = {"program", "a", "b", "-v"};
+  ASSERT_TRUE(m_options.parse(4, const_cast<char**>(argv)));
+
+  EXPECT_EQ(seen, std::vector<std::string>({"a", "b"}));
+  EXPECT_TRUE(m_options.positional_args().empty());
+}
+
+TEST_F(Options_test, ReadPositionals) {
+  int fds[2];
+  ASSERT_EQ(::pipe(fds), 0);
+
+  /* Longer than the read buffer so that items span reads */
+  std::string input;
+  for (int i = 0; i < 20000; ++i) {
+    input += "path/" + std::to_string(i) + '\0';
+  }
+  input += "last";
+
+  std::thread writer([&] {
+    EXPECT_EQ(::write(fds[1], input.data(), input.size()), ssize_t(input.size()));
+    ::close(fds[1]);
+  });
+
+  std::size_t count{};
+  std::string last;
+
+  m_options.on_positional([&](std::string_view arg) {
+    EXPECT_TRUE(arg.starts_with("path/") || arg == "last");
+    ++count;
+    last = arg;
+  });
+
+  auto result = m_options.read_positionals(fds[0]);
+  writer.join();
+  ::close(fds[0]);
+
+  ASSERT_TRUE(result.has_value());
+  EXPECT_EQ(*result, 20001);
+  EXPECT_EQ(count, 20001);
+  EXPECT_EQ(last, "last");
+}
+
+TEST_F(Options_test, Freeze) {
+  auto port = m_options.add_option<int>({.m_long_name = "port", .m_description = "Port number", .m_default_value = 1});
+
+  auto snapshot = m_options.freeze();
+
+  const char* argv[] = {"program", "--port=2"};
+  ASSERT_TRUE(m_options.parse(2, const_cast<char**>(argv)));
+
+  /* The snapshot does not see later changes */
+  EXPECT_EQ(*(*snapshot)[port], 1);
+  EXPECT_EQ(snapshot->get<int>("port"), 1);
+  EXPECT_EQ(*m_options[port], 2);
+  EXPECT_EQ(m_options.freeze()->get<int>("port"), 2);
+}
+
+TEST_F(Options_test, PublishSnapshots) {
+  auto port = m_options.add_option<int>({.m_long_name = "port", .m_description = "Port number", .m_default_value = 0});
+
+  cli::Snapshot_publisher publisher(m_options.freeze());
+  std::atomic<bool> done{};
+  std::vector<std::thread> readers;
+
+  for (int i = 0; i < 4; ++i) {
+    readers.emplace_back([&] {
+      cli::Snapshot_publisher::Reader reader(publisher);
+      int last{};
+
+      while (!done.load()) {
+        /* Values only move forward */
+        const int value = *reader.get()[port];
+        EXPECT_GE(value, last);
+        last = value;
+      }
+    });
+  }
+
+  for (int i = 1; i <= 100; ++i) {
+    auto arg = std::format("--port={}", i);
+    const char* argv[] = {"program", arg.c_str()};
+    ASSERT_TRUE(m_options.parse(2, const_cast<char**>(argv)));
+    publisher.publish(m_options.freeze());
+  }
+
+  done = true;
+  for (auto& reader : readers) {
+    reader.join();
+  }
+
+  EXPECT_EQ(publisher.version(), 100);
+  EXPECT_EQ(*(*publisher.load())[port], 100);
+}
+
+TEST_F(Options_test, ValueSources) {
+  ::setenv("CLI_TEST_PORT", "3", 1);
+  auto port = m_options.add_option<int>({.m_long_name = "port", .m_description = "Port number", .m_default_value = 1, .m_env_var = "CLI_TEST_PORT"});
+  auto level = m_options.add_option<int>({.m_long_name = "level", .m_description = "Level", .m_default_value = 1});
+  ::unsetenv("CLI_TEST_PORT");
+
+  /* The environment wins over the default */
+  EXPECT_EQ(*m_options[port], 3);
+  EXPECT_EQ(m_options.source("port"), cli::Value_source::env);
+
+  const cli::Assignment file[] = {{"port", "2"}, {"level", "2"}};
+  ASSERT_TRUE(m_options.set(file));
+  EXPECT_EQ(*m_options[port], 3);
+  EXPECT_EQ(*m_options[level], 2);
+  EXPECT_EQ(m_options.source("level"), cli::Value_source::file);
+
+  const char* argv[] = {"program", "--port=4"};
+  ASSERT_TRUE(m_options.parse(2, const_cast<char**>(argv)));
+  EXPECT_EQ(*m_options[port], 4);
+
+  m_options.reset(cli::Value_source::argv);
+  m_options.reset(cli::Value_source::env);
+  EXPECT_EQ(*m_options[port], 2);
+  EXPECT_EQ(m_options.source("port"), cli::Value_source::file);
+  EXPECT_EQ(m_options.source("missing"), std::nullopt);
+}
+
+TEST_F(Options_test, ImportEnv) {
+  m_options.defer_env();
+
+  auto connections = m_options.add_option<int>({.m_long_name = "max-connections", .m_description = "Connections", .m_default_value = 1});
+  auto port = m_options.add_option<int>({.m_long_name = "port", .m_description = "Port number", .m_default_value = 1, .m_env_var = "CLI_TEST_PORT"});
+  auto verbose = m_options.add_option<bool>({.m_short_name = "v", .m_description = "Verbose", .m_env_var = "CLI_TEST_VERBOSE"});
+
+  ::setenv("CLI_TEST_MAX_CONNECTIONS", "100", 1);
+  ::setenv("CLI_TEST_PORT", "2", 1);
+
+  /* Deferred, nothing was read yet */
+  EXPECT_EQ(*m_options[port], 1);
+
+  auto result = m_options.import_env("CLI_TEST_");
+  ASSERT_TRUE(result);
+  EXPECT_EQ(*result, 2);
+  EXPECT_EQ(*m_options[connections], 100);
+  EXPECT_EQ(*m_options[port], 2);
+  EXPECT_EQ(m_options.source("port"), cli::Value_source::env);
+  EXPECT_EQ(m_options[verbose], nullptr);
+
+  /* A bad value names the variable and sets nothing */
+  ::setenv("CLI_TEST_MAX_CONNECTIONS", "200", 1);
+  ::setenv("CLI_TEST_VERBOSE", "maybe", 1);
+  result = m_options.import_env("CLI_TEST_");
+  ::unsetenv("CLI_TEST_MAX_CONNECTIONS");
+  ::unsetenv("CLI_TEST_PORT");
+  ::unsetenv("CLI_TEST_VERBOSE");
+
+  ASSERT_FALSE(result);
+  ASSERT_EQ(result.error().size(), 1);
+  EXPECT_EQ(result.error()[0].m_option, "CLI_TEST_VERBOSE");
+  EXPECT_EQ(*m_options[connections], 100);
+
+  /* Without a prefix only explicit variables are read */
+  ::setenv("CLI_TEST_MAX_CONNECTIONS", "300", 1);
+  EXPECT_EQ(m_options.import_env(), 0);
+  ::unsetenv("CLI_TEST_MAX_CONNECTIONS");
+}
+
+TEST_F(Options_test, ClearPendingDiagnostics) {
+  ::setenv("CLI_TEST_PORT", "not-a-number", 1);
+  m_options.add_option<int>({.m_long_name = "port", .m_description = "Port number", .m_env_var = "CLI_TEST_PORT"});
+  ::unsetenv("CLI_TEST_PORT");
+  m_options.enable_lazy_collections();
+
+  /* Nothing found for the options before clear() is reported after it */
+  m_options.clear();
+  auto numbers = m_options.add_option<cli::Array_value<int>>({.m_long_name = "numbers", .m_description = "Numbers"});
+
+  const char* argv[] = {"program", "--numbers=1,x"};
+  auto result = m_options.try_parse(2, const_cast<char**>(argv));
+  ASSERT_FALSE(result);
+  ASSERT_EQ(result.error().size(), 1);
+  EXPECT_EQ(result.error()[0].m_code, cli::Diagnostic_code::invalid_value);
+  EXPECT_EQ(result.error()[0].m_option, "numbers");
+  EXPECT_EQ(m_options[numbers], nullptr);
+
+  const char* good[] = {"program", "--numbers=1,2"};
+  EXPECT_TRUE(m_options.try_parse(2, const_cast<char**>(good)));
+  EXPECT_EQ(m_options[numbers]->size(), 2);
+}
+
+TEST_F(Options_test, ClearSettings) {
+  m_options.enable_response_files();
+  m_options.clear();
+
+  /* Like new options, @ arguments are positional */
+  const char* argv[] = {"program", "@args.rsp"};
+  ASSERT_TRUE(m_options.try_parse(2, const_cast<char**>(argv)));
+  EXPECT_EQ(m_options.positional_args(), std::vector<std::string>{"@args.rsp"});
+
+  /* and add_option() reads the environment */
+  m_options.defer_env();
+  m_options.clear();
+
+  ::setenv("CLI_TEST_CLEAR_PORT", "3", 1);
+  auto port = m_options.add_option<int>({.m_long_name = "port", .m_description = "Port number", .m_env_var = "CLI_TEST_CLEAR_PORT"});
+  ::unsetenv("CLI_TEST_CLEAR_PORT");
+
+  ASSERT_NE(m_options[port], nullptr);
+  EXPECT_EQ(*m_options[port], 3);
+}
+
+TEST_F(Options_test, LazyCollections) {
+  auto numbers = m_options.add_option<cli::Array_value<int>>({.m_long_name = "numbers", .m_description = "Numbers"});
+  auto limits = m_options.add_option<cli::Map_value<std::string, int>>({.m_long_name = "limits", .m_description = "Limits"});
+  auto hosts = m_options.add_option<cli::Array_value<std::string>>({.m_long_name = "hosts", .m_description = "Hosts"});
+
+  std::vector<std::string> seen;
+  m_options.on_change(hosts, [&](const cli::Array_value<std::string>& value) { seen = value.values(); });
+
+  m_options.add_validation("limits", [](const cli::Value_variant& value) {
+    return std::get<cli::Map_value<std::string, int>>(value).size() <= 1;
+  });
+
+  m_options.enable_lazy_collections();
+
+  /* Errors in lazy values only show when they are converted */
+  const char* argv[] = {"program", "--numbers=1,2,3", "--limits=cpu=2,memory=512", "--hosts=a,b"};
+  ASSERT_TRUE(m_options.parse(4, const_cast<char**>(argv)));
+
+  /* Options with a change callback are converted right away */
+  EXPECT_EQ(seen, (std::vector<std::string>{"a", "b"}));
+
+  auto snapshot = m_options.freeze();
+  std::vector<const cli::Array_value<int>*> reads(4);
+  std::vector<std::thread> readers;
+
+  for (std::size_t i = 0; i < reads.size(); ++i) {
+    readers.emplace_back([&, i] { reads[i] = (*snapshot)[numbers]; });
+  }
+  for (auto& reader : readers) {
+    reader.join();
+  }
+
+  /* Converted once, shared with the snapshot */
+  ASSERT_NE(reads[0], nullptr);
+  EXPECT_EQ(reads[0]->values(), (std::vector<int>{1, 2, 3}));
+  EXPECT_TRUE(std::ranges::all_of(reads, [&](const auto* read) { return read == reads[0]; }));
+  EXPECT_EQ(m_options[numbers], reads[0]);
+
+  /* A value that fails conversion is missing for has_value() too */
+  EXPECT_EQ(m_options[limits], nullptr);
+  EXPECT_FALSE(m_options.has_value("limits"));
+  EXPECT_FALSE(snapshot->has_value("limits"));
+  EXPECT_FALSE(cli::Overlay<>(*snapshot).has_value("limits"));
+  EXPECT_TRUE(snapshot->has_value("numbers"));
+
+  auto result = m_options.validate_all();
+  ASSERT_FALSE(result);
+  ASSERT_EQ(result.error().size(), 1);
+  EXPECT_EQ(result.error()[0].m_code, cli::Diagnostic_code::validation_failed);
+  EXPECT_EQ(result.error()[0].m_option, "limits");
+
+  /* A value set later replaces the text */
+  const char* fix[] = {"program", "--limits=cpu=2"};
+  ASSERT_TRUE(m_options.parse(2, const_cast<char**>(fix)));
+  EXPECT_EQ(m_options[limits]->at("cpu"), 2);
+  EXPECT_TRUE(m_options.validate_all());
+
+  /* Re-adding an option drops text given for the one it replaces */
+  const char* more[] = {"program", "--numbers=4,5"};
+  ASSERT_TRUE(m_options.parse(2, const_cast<char**>(more)));
+  numbers = m_options.add_option<cli::Array_value<int>>({.m_long_name = "numbers", .m_description = "Numbers", .m_default_value = cli::Array_value<int>({7})});
+  ASSERT_NE(m_options[numbers], nullptr);
+  EXPECT_EQ(m_options[numbers]->values(), std::vector<int>{7});
+}
+
+TEST_F(Options_test, ValueTable) {
+  auto port = m_options.add_option<int>({.m_long_name = "port", .m_description = "Port number", .m_default_value = 1});
+  auto ratio = m_options.add_option<double>({.m_long_name = "ratio", .m_description = "Ratio", .m_default_value = 0.5});
+  auto name = m_options.add_option<std::string>({.m_long_name = "name", .m_description = "Name", .m_default_value = std::string("a")});
+  auto verbose = m_options.add_option<bool>({.m_short_name = "v", .m_description = "Verbose"});
+
+  EXPECT_EQ(*m_options[port], 1);
+  EXPECT_EQ(*m_options[ratio], 0.5);
+  EXPECT_EQ(*m_options[name], "a");
+  EXPECT_EQ(m_options[verbose], nullptr);
+
+  /* Reading with the wrong type finds nothing */
+  EXPECT_EQ(m_options[cli::Option_handle<double>{port.m_id}], nullptr);
+
+  const char* argv[] = {"program", "--port=2", "--ratio=1.5", "--name=b", "-v"};
+  ASSERT_TRUE(m_options.parse(5, const_cast<char**>(argv)));
+
+  auto snapshot = m_options.freeze();
+
+  /* Scalars are copies, later changes do not reach the snapshot */
+  m_options.reset(cli::Value_source::argv);
+  EXPECT_EQ(*m_options[port], 1);
+  EXPECT_EQ(*m_options[name], "a");
+  EXPECT_EQ(m_options[verbose], nullptr);
+
+  EXPECT_EQ(*(*snapshot)[port], 2);
+  EXPECT_EQ(*(*snapshot)[ratio], 1.5);
+  EXPECT_EQ(*(*snapshot)[name], "b");
+  EXPECT_TRUE(*(*snapshot)[verbose]);
+}
+
+TEST_F(Options_test, ReplaceOption) {
+  cli::Option_descriptor desc{.m_short_name = "l", .m_long_name = "limits", .m_description = "Limits", .m_default_value = cli::Map_value<std::string, int>({{"cpu", 1}})};
+
+  m_options.add_option<cli::Map_value<std::string, int>>(desc);
+  EXPECT_EQ(desc.m_long_name, "limits");
+
+  /* Re-adding moves the new descriptor in and drops the old short name */
+  desc.m_short_name = "L";
+  desc.m_required = true;
+  desc.m_default_value.reset();
+  auto limits = m_options.add_option<cli::Map_value<std::string, int>>(std::move(desc));
+
+  EXPECT_EQ(m_options[limits], nullptr);
+
+  const char* missing[] = {"program"};
+  auto result = m_options.try_parse(1, const_cast<char**>(missing));
+  ASSERT_FALSE(result);
+  EXPECT_EQ(result.error()[0].m_code, cli::Diagnostic_code::missing_required);
+  EXPECT_EQ(result.error()[0].m_option, "limits");
+
+  const char* old_name[] = {"program", "-l", "cpu=2"};
+  EXPECT_FALSE(m_options.try_parse(3, const_cast<char**>(old_name)));
+
+  const char* argv[] = {"program", "-L", "cpu=2"};
+  ASSERT_TRUE(m_options.try_parse(3, const_cast<char**>(argv)));
+  EXPECT_EQ(m_options[limits]->at("cpu"), 2);
+  EXPECT_TRUE(m_options.has_value("limits"));
+  EXPECT_FALSE(m_options.has_value("L"));
+}
+
+TEST_F(Options_test, StringViewLookup) {
+  m_options.add_option<int>({.m_long_name = "port", .m_description = "Port number", .m_default_value = 1});
+  m_options.add_option<bool>({.m_short_name = "v", .m_description = "Verbose"});
+
+  /* Names cut out of a larger string, no std::string is built */
+  const std::string_view text = "port,v,verbose";
+  const auto port = text.substr(0, 4);
+  const auto verbose = text.substr(5, 1);
+
+  m_options.add_validation(port, [](const cli::Value_variant& value) { return std::get<int>(value) > 0; });
+
+  EXPECT_EQ(m_options.get<int>(port), 1);
+  EXPECT_TRUE(m_options.has_value(port));
+  EXPECT_FALSE(m_options.has_value(verbose));
+  EXPECT_FALSE(m_options.has_value(text.substr(7)));
+
+  const char* argv[] = {"program", "--port=0", "-v"};
+  EXPECT_FALSE(m_options.try_parse(3, const_cast<char**>(argv)));
+  EXPECT_TRUE(m_options.has_value(verbose));
+}
+
+TEST_F(Options_test, MemoryResource) {
+  Counting_resource upstream;
+  std::pmr::monotonic_buffer_resource arena(&upstream);
+  cli::Options options(&arena);
+
+  auto port = options.add_option<int>({.m_short_name = "p", .m_long_name = "port", .m_description = "Port number", .m_default_value = 1});
+  auto hosts = options.add_option<cli::Array_value<std::string>>({.m_long_name = "hosts", .m_description = "Hosts"});
+
+  options.add_validation("port", [](const cli::Value_variant& value) { return std::get<int>(value) > 0; });
+
+  const char* argv[] = {"program", "-p", "2", "--hosts=a,b"};
+  ASSERT_TRUE(options.parse(4, const_cast<char**>(argv)));
+  EXPECT_EQ(*options[port], 2);
+  EXPECT_EQ(options[hosts]->size(), 2);
+  EXPECT_EQ(options.resource(), &arena);
+
+  /* Derived options allocate from the same resource */
+  auto derived = options.derive();
+  EXPECT_EQ(derived.resource(), &arena);
+
+  const char* more[] = {"program", "--port=3"};
+  ASSERT_TRUE(derived.parse(2, const_cast<char**>(more)));
+  EXPECT_EQ(*derived[port], 3);
+  EXPECT_EQ(*options[port], 2);
+
+  const std::string_view entry[] = {"--port=4"};
+  const std::span<const std::string_view> batch[] = {entry};
+  auto results = options.parse_batch(batch, 1, &arena);
+  ASSERT_TRUE(results[0]);
+  EXPECT_EQ(results[0]->resource(), &arena);
+  EXPECT_EQ(*(*results[0])[port], 4);
+
+  /* Everything went through the arena, which took a few large blocks */
+  EXPECT_GT(upstream.m_allocations, 0);
+  EXPECT_LT(upstream.m_allocations, 5);
+}
+
+TEST_F(Options_test, HelpText) {
+  m_options.add_option<int>({.m_short_name = "p", .m_long_name = "port", .m_description = "Port number", .m_required = true, .m_default_value = 8080});
+  m_options.add_option<cli::Array_value<int>>({.m_long_name = "ids", .m_description = "Ids", .m_default_value = *cli::Array_value<int>::parse("1,2,3")});
+
+  /* Rendered once and reused */
+  const auto& text = m_options.help_text();
+  EXPECT_EQ(&text, &m_options.help_text());
+  EXPECT_TRUE(text.starts_with("Options:\n"));
+  EXPECT_NE(text.find("-p, --port (required) [default: 8080]"), std::string::npos);
+  EXPECT_NE(text.find("--ids [default: 1,2,3]"), std::string::npos);
+
+  /* Long collection defaults are cut */
+  std::string many;
+  for (int i = 0; i < 1000; ++i) {
+    many += std::format("{}{}", i == 0 ? "" : ",", i);
+  }
+  m_options.add_option<cli::Array_value<int>>({.m_long_name = "many", .m_description = "Many", .m_default_value = *cli::Array_value<int>::parse(many)});
+
+  const auto& updated = m_options.help_text();
+  const auto line = updated.substr(updated.find("--many"));
+  EXPECT_NE(line.find(",... (1000 values)]"), std::string::npos);
+  EXPECT_LT(line.find('\n'), 120);
+
+  std::ostringstream out;
+  m_options.print_help(out, "program");
+  EXPECT_EQ(out.str(), "Usage: program [OPTIONS] [ARGUMENTS]\n" + updated);
+
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+  ASSERT_TRUE(m_options.print_help(fds[1], "program"));
+  close(fds[1]);
+
+  std::string written(out.str().size() + 1, '\0');
+  EXPECT_EQ(read(fds[0], written.data(), written.size()), ssize_t(out.str().size()));
+  written.resize(out.str().size());
+  close(fds[0]);
+  EXPECT_EQ(written, out.str());
+
+  /* An unbuffered stream gets the whole message in one write, also for
+  another program name */
+  struct Write_counter : std::stringbuf {
+    int m_writes{};
+
+    std::streamsize xsputn(const char* s, std::streamsize n) override {
+      ++m_writes;
+      return std::stringbuf::xsputn(s, n);
+    }
+  };
+
+  Write_counter buffer;
+  std::ostream unbuffered(&buffer);
+
+  m_options.print_help(unbuffered, "other");
+  EXPECT_EQ(buffer.m_writes, 1);
+  EXPECT_EQ(buffer.str(), "Usage: other [OPTIONS] [ARGUMENTS]\n" + updated);
+
+  /* Cleared options render again */
+  m_options.clear();
+  EXPECT_EQ(m_options.help_text(), "Options:\n");
+}
+
+TEST_F(Options_test, Derive) {
+  auto port = m_options.add_option<int>({.m_long_name = "port", .m_description = "Port number", .m_default_value = 1});
+  auto host = m_options.add_option<std::string>({.m_long_name = "host", .m_description = "Host name", .m_default_value = std::string("base")});
+
+  auto derived = m_options.derive();
+  auto snapshot = m_options.freeze();
+
+  /* Unchanged values are shared, not copied */
+  EXPECT_EQ(derived[host], m_options[host]);
+
+  const char* argv[] = {"program", "--port=2"};
+  ASSERT_TRUE(derived.parse(2, const_cast<char**>(argv)));
+  EXPECT_EQ(*derived[port], 2);
+  EXPECT_EQ(*m_options[port], 1);
+
+  /* Writing to a shared layer copies it first */
+  const cli::Assignment base[] = {{"host", "changed"}};
+  ASSERT_TRUE(m_options.set(base, cli::Value_source::defaults));
+  EXPECT_EQ(*m_options[host], "changed");
+  EXPECT_EQ(*derived[host], "base");
+  EXPECT_EQ(*(*snapshot)[host], "base");
+}
+
+TEST_F(Options_test, Overlay) {
+  auto port = m_options.add_option<int>({.m_long_name = "port", .m_description = "Port number", .m_default_value = 1});
+  auto name = m_options.add_option<std::string>({.m_long_name = "name", .m_description = "Name"});
+  auto limits = m_options.add_option<cli::Map_value<std::string, int>>({.m_long_name = "limits", .m_description = "Limits"});
+
+  m_options.add_validation("port", [](const cli::Value_variant& value) {
+    return std::get<int>(value) > 0;
+  });
+
+  auto snapshot = m_options.freeze();
+  cli::Overlay<2> overlay(*snapshot);
+
+  ASSERT_TRUE(overlay.set("limits", "cpu=2,memory=512"));
+  ASSERT_TRUE(overlay.set("port", "8080"));
+  EXPECT_EQ(overlay[limits]->at("memory"), 512);
+  EXPECT_EQ(*overlay[port], 8080);
+  EXPECT_EQ(*(*snapshot)[port], 1);
+
+  /* Replacing an override takes no new slot */
+  ASSERT_TRUE(overlay.set("port", "8081"));
+  EXPECT_EQ(overlay.get<int>("port"), 8081);
+
+  EXPECT_EQ(overlay.set("name", "x").error().m_code, cli::Diagnostic_code::too_many_overrides);
+  EXPECT_EQ(overlay.set("port", "0").error().m_code, cli::Diagnostic_code::validation_failed);
+  EXPECT_EQ(overlay.set("port", "x").error().m_code, cli::Diagnostic_code::invalid_value);
+  EXPECT_EQ(overlay.set("missing", "1").error().m_code, cli::Diagnostic_code::unknown_option);
+  EXPECT_EQ(*overlay[port], 8081);
+
+  /* Reads fall through to the snapshot after clear() */
+  overlay.clear();
+  EXPECT_EQ(*overlay[port], 1);
+  EXPECT_FALSE(overlay.has_value("name"));
+
+  const cli::Assignment request[] = {{"name", "request"}};
+  ASSERT_TRUE(overlay.set(request));
+  EXPECT_EQ(*overlay[name], "request");
+  EXPECT_EQ(overlay.size(), 1);
+
+  /* A string override is overwritten in place, a rejected text leaves it */
+  m_options.add_validation("name", [](const cli::Value_variant& value) {
+    return std::get<std::string>(value) != "rejected";
+  });
+  snapshot = m_options.freeze();
+
+  cli::Overlay<2> strings(*snapshot);
+  ASSERT_TRUE(strings.set("name", "a name longer than the small string buffer"));
+  const auto* buffer = strings[name]->data();
+
+  ASSERT_TRUE(strings.set("name", "another name, also longer than the buffer"));
+  EXPECT_EQ(*strings[name], "another name, also longer than the buffer");
+  EXPECT_EQ(strings[name]->data(), buffer);
+
+  EXPECT_EQ(strings.set("name", "rejected").error().m_code, cli::Diagnostic_code::validation_failed);
+  EXPECT_EQ(*strings[name], "another name, also longer than the buffer");
+  EXPECT_EQ(strings.size(), 1);
+}
+
+TEST(Subcommand_test, Dispatch) {
+  cli::Subcommands commands;
+  cli::Option_handle<int> port;
+  cli::Option_handle<bool> strict;
+  int serve_built{};
+  int check_built{};
+
+  commands.add("serve", "Run the server", [&] {
+    ++serve_built;
+    cli::Options options;
+    port = options.add_option<int>({.m_short_name = "p", .m_long_name = "port", .m_description = "Port", .m_default_value = 80});
+    return options;
+  });
+
+  commands.add("check", "Check the config", [&] {
+    ++check_built;
+    cli::Options options;
+    strict = options.add_option<bool>({.m_long_name = "strict", .m_description = "Strict"});
+    return options;
+  });
+
+  EXPECT_EQ(commands.size(), 2);
+  EXPECT_TRUE(commands.contains("serve"));
+  EXPECT_FALSE(commands.contains("stop"));
+
+  /* Only the selected command builds its options */
+  const char* argv[] = {"tool", "serve", "-p", "8080", "extra"};
+  auto command = commands.try_parse(5, const_cast<char**>(argv));
+  ASSERT_TRUE(command);
+  EXPECT_EQ(command->m_name, "serve");
+  EXPECT_EQ(*command->m_options[port], 8080);
+  EXPECT_EQ(command->m_result.m_positional_count, 1);
+  EXPECT_EQ(command->m_options.positional_args(), std::vector<std::string>{"extra"});
+  EXPECT_EQ(serve_built, 1);
+  EXPECT_EQ(check_built, 0);
+
+  const std::string_view args[] = {"check", "--strict"};
+  auto checked = commands.try_parse(args);
+  ASSERT_TRUE(checked);
+  EXPECT_TRUE(*checked->m_options[strict]);
+  EXPECT_EQ(serve_built, 1);
+  EXPECT_EQ(check_built, 1);
+
+  const char* unknown[] = {"tool", "stop"};
+  auto failed = commands.try_parse(2, const_cast<char**>(unknown));
+  ASSERT_FALSE(failed);
+  EXPECT_EQ(failed.error()[0].m_code, cli::Diagnostic_code::unknown_command);
+  EXPECT_EQ(failed.error()[0].to_string(), "Unknown command: stop");
+
+  const char* missing[] = {"tool"};
+  failed = commands.try_parse(1, const_cast<char**>(missing));
+  ASSERT_FALSE(failed);
+  EXPECT_EQ(failed.error()[0].m_code, cli::Diagnostic_code::missing_command);
+
+  /* Option errors come from the options of the command */
+  const char* bad[] = {"tool", "serve", "extra", "--port=x"};
+  failed = commands.try_parse(4, const_cast<char**>(bad));
+  ASSERT_FALSE(failed);
+  EXPECT_EQ(failed.error()[0].m_code, cli::Diagnostic_code::invalid_value);
+
+  /* Positions are in argv, like the one of an unknown command */
+  EXPECT_EQ(failed.error()[0].m_arg_index, 3);
+  EXPECT_EQ(std::string_view(bad[failed.error()[0].m_arg_index]), "--port=x");
+
+  const std::string_view bad_args[] = {"serve", "-p", "x"};
+  failed = commands.try_parse(bad_args);
+  ASSERT_FALSE(failed);
+  EXPECT_EQ(failed.error()[0].m_arg_index, 2);
+
+  EXPECT_THROW(commands.add("serve", "Again", [] { return cli::Options(); }), cli::Option_error);
+  EXPECT_THROW(commands.add("", "Empty", [] { return cli::Options(); }), cli::Option_error);
+}
+
+TEST(Batch_test, ParallelFor) {
+  std::vector<std::atomic<int>> calls(1000);
+
+  /* Uneven work so that the threads steal from each other */
+  cli::parallel_for(calls.size(), 4, [&](std::size_t i) {
+    if (i < 10) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ++calls[i];
+  });
+
+  EXPECT_TRUE(std::ranges::all_of(calls, [](const auto& n) { return n == 1; }));
+
+  cli::parallel_for(0, 4, [](std::size_t) { FAIL(); });
+}
+
+TEST_F(Options_test, ParseBatch) {
+  auto port = m_options.add_option<int>({.m_long_name = "port", .m_description = "Port number", .m_default_value = 1});
+  auto name = m_options.add_option<std::string_view>({.m_long_name = "name", .m_description = "Name", .m_required = true});
+
+  std::vector<std::string> text;
+  std::vector<std::vector<std::string_view>> args(100);
+  std::vector<std::span<const std::string_view>> batch;
+
+  text.reserve(args.size());
+
+  for (std::size_t i = 0; i < args.size(); ++i) {
+    text.push_back(std::format("--port={}", i));
+    args[i] = {text.back(), "--name", "job", "input"};
+
+    /* Every tenth entry is missing the required option */
+    if (i % 10 == 0) {
+      args[i].resize(1);
+    }
+    batch.emplace_back(args[i]);
+  }
+
+  auto results = m_options.parse_batch(batch, 4);
+
+  ASSERT_EQ(results.size(), batch.size());
+
+  for (std::size_t i = 0; i < results.size(); ++i) {
+    if (i % 10 == 0) {
+      ASSERT_FALSE(results[i]);
+      EXPECT_EQ(results[i].error()[0].m_code, cli::Diagnostic_code::missing_required);
+    } else {
+      ASSERT_TRUE(results[i]);
+      EXPECT_EQ(*(*results[i])[port], int(i));
+      EXPECT_EQ(*(*results[i])[name], "job");
+      EXPECT_EQ(results[i]->positional_args(), std::vector<std::string>{"input"});
+    }
+  }
+
+  /* The base options are not changed */
+  EXPECT_EQ(*m_options[port], 1);
+  EXPECT_FALSE(m_options.has_value("name"));
+}
+
+/* Monotonic arena that counts the calls made while another is running */
+struct Arena_resource : std::pmr::memory_resource {
+  std::pmr::monotonic_buffer_resource m_arena;
+  std::atomic<int> m_active{};
+  std::atomic<std::size_t> m_allocations{};
+  std::atomic<std::size_t> m_overlaps{};
+
+private:
+  void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+    if (m_active.fetch_add(1) != 0) {
+      ++m_overlaps;
+    }
+    ++m_allocations;
+    auto* p = m_arena.allocate(bytes, alignment);
+    --m_active;
+    return p;
+  }
+
+  void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override {
+    m_arena.deallocate(p, bytes, alignment);
+  }
+
+  bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+    return this == &other;
+  }
+};
+
+TEST(Batch_test, ArenaOptions) {
+  Arena_resource arena;
+  cli::Options options(&arena);
+
+  auto port = options.add_option<int>({.m_long_name = "port", .m_description = "Port number", .m_default_value = 1});
+  auto hosts = options.add_option<cli::Array_value<std::string>>({.m_long_name = "hosts", .m_description = "Hosts"});
+
+  std::vector<std::string> ports;
+  std::vector<std::array<std::string_view, 2>> args(1000);
+  std::vector<std::span<const std::string_view>> batch;
+
+  for (std::size_t i = 0; i < args.size(); ++i) {
+    ports.push_back(std::format("--port={}", i));
+  }
+  for (std::size_t i = 0; i < args.size(); ++i) {
+    args[i] = {ports[i], "--hosts=a,b,c"};
+    batch.emplace_back(args[i]);
+  }
+
+  /* The workers allocate from the default resource, never from the arena
+  of the options */
+  const auto before = arena.m_allocations.load();
+  auto results = options.parse_batch(batch, 4);
+
+  EXPECT_EQ(arena.m_allocations.load(), before);
+  EXPECT_EQ(arena.m_overlaps.load(), 0);
+
+  for (std::size_t i = 0; i < results.size(); ++i) {
+    ASSERT_TRUE(results[i]);
+    EXPECT_EQ(results[i]->resource(), std::pmr::get_default_resource());
+    EXPECT_EQ(*(*results[i])[port], int(i));
+    EXPECT_EQ((*results[i])[hosts]->size(), 3);
+  }
+}
+
+class Image_test : public Temp_dir_test {};
+
+TEST_F(Image_test, WriteAndMap) {
+  auto port = m_options.add_option<int>({.m_long_name = "port", .m_description = "Port number", .m_default_value = 1});
+  auto ratio = m_options.add_option<double>({.m_long_name = "ratio", .m_description = "Ratio"});
+  auto verbose = m_options.add_option<bool>({.m_short_name = "v", .m_description = "Verbose"});
+  auto name = m_options.add_option<std::string>({.m_long_name = "name", .m_description = "Name"});
+  auto hosts = m_options.add_option<cli::Array_value<std::string>>({.m_long_name = "hosts", .m_description = "Hosts"});
+  auto weights = m_options.add_option<cli::Array_value<double>>({.m_long_name = "weights", .m_description = "Weights"});
+  auto limits = m_options.add_option<cli::Map_value<std::string, int>>({.m_long_name = "limits", .m_description = "Limits"});
+  auto labels = m_options.add_option<cli::Map_value<std::string, std::string>>({.m_long_name = "labels", .m_description = "Labels"});
+  auto unset = m_options.add_option<int>({.m_long_name = "unset", .m_description = "Unset"});
+
+  const char* argv[] = {"program", "--ratio=0.25", "-v", "--name=job", "--hosts=a,bb,ccc", "--weights=0.5,1.5",
+    "--limits=memory=512,cpu=4", "--labels=zone=eu,tier=web"};
+  ASSERT_TRUE(m_options.parse(8, const_cast<char**>(argv)));
+
+  const auto path = (m_dir / "options.img").string();
+  const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  ASSERT_NE(fd, -1);
+  ASSERT_TRUE(cli::Options_image::write(*m_options.freeze(), fd));
+  ::close(fd);
+
+  /* A worker declares the same options and maps the image */
+  cli::Options worker;
+  std::ignore = worker.add_option<int>({.m_long_name = "port", .m_description = "Port number", .m_default_value = 1});
+
+  auto image = cli::Options_image::open(path);
+  ASSERT_TRUE(image) << image.error().to_string();
+  EXPECT_EQ(image->size(), 9);
+  EXPECT_TRUE(image->matches(m_options));
+  EXPECT_FALSE(image->matches(worker));
+
+  EXPECT_EQ(image->get(port), 1);
+  EXPECT_EQ(image->get(ratio), 0.25);
+  EXPECT_EQ(image->get(verbose), true);
+  EXPECT_EQ(image->get(name), "job");
+  EXPECT_EQ(image->get(unset), std::nullopt);
+  EXPECT_EQ(image->get<std::string>("port"), std::nullopt);
+  EXPECT_TRUE(image->has_value("v"));
+  EXPECT_FALSE(image->has_value("unset"));
+  EXPECT_FALSE(image->has_value("missing"));
+
+  auto host_list = image->get(hosts);
+  ASSERT_TRUE(host_list);
+  EXPECT_EQ(std::vector<std::string_view>(host_list->begin(), host_list->end()), (std::vector<std::string_view>{"a", "bb", "ccc"}));
+  EXPECT_EQ((*image->get(weights))[1], 1.5);
+
+  auto limit_map = image->get<cli::Map_value<std::string, int>>("limits");
+  ASSERT_TRUE(limit_map);
+  EXPECT_EQ(limit_map->size(), 2);
+  EXPECT_EQ(limit_map->key(0), "cpu");
+  EXPECT_EQ(limit_map->find("memory"), 512);
+  EXPECT_EQ(limit_map->find("disk"), std::nullopt);
+  EXPECT_EQ(image->get(labels)->find("zone"), "eu");
+  EXPECT_EQ(image->get(limits)->value(0), 4);
+
+  /* Damaged images are rejected before anything is read */
+  auto bytes = cli::Options_image::write(*m_options.freeze());
+  EXPECT_TRUE(cli::Options_image::view(bytes));
+  EXPECT_FALSE(cli::Options_image::view(std::string_view(bytes).substr(0, bytes.size() - 1)));
+
+  auto bad_magic = bytes;
+  bad_magic[0] = 'X';
+  auto result = cli::Options_image::view(bad_magic);
+  ASSERT_FALSE(result);
+  EXPECT_EQ(result.error().m_code, cli::Diagnostic_code::bad_image);
+
+  EXPECT_FALSE(cli::Options_image::open((m_dir / "missing.img").string()));
+}
+
+class Completion_test : public Temp_dir_test {};
+
+TEST_F(Completion_test, Lookup) {
+  m_options.add_option<int>({.m_short_name = "p", .m_long_name = "port", .m_description = "Port"});
+  m_options.add_option<std::string>({.m_long_name = "mode", .m_description = "Mode"});
+  m_options.add_option<bool>({.m_short_name = "v", .m_long_name = "verbose", .m_description = "Verbose"});
+
+  const cli::Completion_values values{{"mode", {"fast", "safe", "slow"}}};
+  const auto text = cli::Completion_index::write(m_options, values);
+  auto index = cli::Completion_index::view(text);
+  ASSERT_TRUE(index);
+
+  auto complete = [&](std::initializer_list<std::string_view> words) {
+    std::string out;
+    index->complete(std::span(words.begin(), words.size()), out);
+    return out;
+  };
+
+  EXPECT_EQ(complete({"--p"}), "--port\n");
+  EXPECT_EQ(complete({"--"}), "--mode\n--port\n--verbose\n");
+  EXPECT_EQ(complete({"-"}), "--mode\n--port\n--verbose\n-p\n-v\n");
+  EXPECT_EQ(complete({"--mode", "s"}), "safe\nslow\n");
+  EXPECT_EQ(complete({"--mode=f"}), "--mode=fast\n");
+  EXPECT_EQ(complete({"--mode", "=", ""}), "fast\nsafe\nslow\n");
+  EXPECT_EQ(complete({"--verbose=t"}), "--verbose=true\n");
+  EXPECT_EQ(complete({"--port", ""}), "");
+
+  /* A flag takes no value, the next word is an option again */
+  EXPECT_EQ(complete({"--verbose", "--m"}), "--mode\n");
+
+  /* Commands first, then the options of the command */
+  cli::Subcommands commands;
+  commands.add("serve", "Run the server", [] {
+    cli::Options options;
+    options.add_option<int>({.m_long_name = "port", .m_description = "Port"});
+    return options;
+  });
+  commands.add("check", "Check", [] {
+    cli::Options options;
+    options.add_option<bool>({.m_long_name = "strict", .m_description = "Strict"});
+    return options;
+  });
+
+  auto path = write("tool.completion", cli::Completion_index::write(commands));
+  auto mapped = cli::Completion_index::open(path);
+  ASSERT_TRUE(mapped);
+
+  std::string out;
+  const std::string_view first[] = {""};
+  mapped->complete(first, out);
+  EXPECT_EQ(out, "check\nserve\n");
+
+  out.clear();
+  const std::string_view serve[] = {"serve", "--"};
+  mapped->complete(serve, out);
+  EXPECT_EQ(out, "--port\n");
+
+  out.clear();
+  const std::string_view unknown[] = {"stop", "--"};
+  EXPECT_EQ(mapped->complete(unknown, out), 0);
+
+  /* Entry point prints to stdout with one write */
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+  const int saved = dup(STDOUT_FILENO);
+  dup2(fds[1], STDOUT_FILENO);
+
+  const char* argv[] = {"tool", "__complete", "ch"};
+  const auto status = cli::complete_main(3, const_cast<char**>(argv), path);
+
+  dup2(saved, STDOUT_FILENO);
+  close(saved);
+  close(fds[1]);
+
+  char buffer[64]{};
+  EXPECT_EQ(read(fds[0], buffer, sizeof(buffer)), 6);
+  close(fds[0]);
+  EXPECT_EQ(status, 0);
+  EXPECT_EQ(std::string_view(buffer), "check\n");
+
+  const char* normal[] = {"tool", "serve"};
+  EXPECT_FALSE(cli::complete_main(2, const_cast<char**>(normal), path));
+
+  EXPECT_EQ(cli::complete_main(3, const_cast<char**>(argv), write("bad.completion", "garbage")), 1);
+  EXPECT_FALSE(cli::Completion_index::view(text.substr(0, text.size() - 1)));
+
+  /* A bad offset reads as an empty word */
+  auto corrupt = text;
+  const std::uint32_t offset = 0xFFFFFFFF;
+  std::memcpy(corrupt.data() + sizeof(cli::Completion_header) + sizeof(cli::Completion_context), &offset, sizeof(offset));
+  auto damaged = cli::Completion_index::view(corrupt);
+  ASSERT_TRUE(damaged);
+  out.clear();
+  const std::string_view all[] = {"--"};
+  EXPECT_EQ(damaged->complete(all, out), 2);
+
+  EXPECT_NE(cli::completion_script(cli::Completion_shell::bash, "my-tool").find("complete -o default -F _my_tool_complete my-tool"), std::string::npos);
+  EXPECT_NE(cli::completion_script(cli::Completion_shell::zsh, "my-tool").find("#compdef my-tool"), std::string::npos);
+  EXPECT_NE(cli::completion_script(cli::Completion_shell::fish, "my-tool").find("my-tool __complete"), std::string::npos);
+}
+
+class Config_file_test : public Temp_dir_test {};
+
+TEST_F(Config_file_test, Reload) {
+  auto port = m_options.add_option<int>({.m_long_name = "port", .m_description = "Port number", .m_default_value = 0});
+  auto host = m_options.add_option<std::string_view>({.m_long_name = "host", .m_description = "Host name"});
+
+  std::vector<std::string> changes;
+  m_options.on_change(port, [&](const int&) { changes.push_back("port"); });
+  m_options.on_change(host, [&](const std::string_view&) { changes.push_back("host"); });
+  changes.clear();
+
+  cli::Snapshot_publisher publisher(m_options.freeze());
+  cli::Config_file config(m_options, write("app.conf", "# Server\nport = 80\n\nhost = example.com\n"), &publisher);
+
+  EXPECT_EQ(config.load(), 2);
+  EXPECT_EQ(changes, (std::vector<std::string>{"port", "host"}));
+
+  /* Only the changed entry is applied */
+  changes.clear();
+  write("app.conf", "port = 80\nhost = example.org\n");
+  EXPECT_EQ(config.load(), 1);
+  EXPECT_EQ(changes, std::vector<std::string>{"host"});
+  EXPECT_EQ(*(*publisher.load())[host], "example.org");
+  EXPECT_EQ(publisher.version(), 2);
+
+  /* A bad entry rejects the whole reload */
+  changes.clear();
+  write("app.conf", "port = 81\nhost = example.net\nmissing = 1\n");
+  auto result = config.load();
+  ASSERT_FALSE(result);
+  EXPECT_EQ(result.error()[0].m_code, cli::Diagnostic_code::unknown_option);
+  EXPECT_TRUE(changes.empty());
+  EXPECT_EQ(*m_options[port], 80);
+
+  /* One buffer per entry is retained however often the file changes, older
+  snapshots keep theirs */
+  const auto retained = m_options.retained();
+  auto snapshot = publisher.load();
+
+  for (int i = 0; i < 100; ++i) {
+    write("app.conf", std::format("port = 80\nhost = host-{}.example.org\n", i));
+    EXPECT_EQ(config.load(), 1);
+  }
+  EXPECT_EQ(m_options.retained(), retained);
+  EXPECT_EQ(*(*publisher.load())[host], "host-99.example.org");
+  EXPECT_EQ(*(*snapshot)[host], "example.org");
+
+  std::filesystem::remove(m_dir / "app.conf");
+  result = config.load();
+  ASSERT_FALSE(result);
+  EXPECT_EQ(result.error()[0].m_code, cli::Diagnostic_code::bad_config_file);
+}
+
+TEST_F(Config_file_test, RemovedEntry) {
+  auto port = m_options.add_option<int>({.m_long_name = "port", .m_description = "Port number", .m_default_value = 8080});
+  auto level = m_options.add_option<int>({.m_long_name = "level", .m_description = "Level", .m_default_value = 2});
+  auto host = m_options.add_option<std::string_view>({.m_long_name = "host", .m_description = "Host name"});
+
+  std::vector<int> ports;
+  m_options.on_change(port, [&](const int& value) { ports.push_back(value); });
+  ports.clear();
+
+  cli::Snapshot_publisher publisher(m_options.freeze());
+  cli::Config_file config(m_options, write("app.conf", "port = 80\nlevel = 5\nhost = example.com\n"), &publisher);
+
+  EXPECT_EQ(config.load(), 3);
+  EXPECT_EQ(*m_options[level], 5);
+  const auto retained = m_options.retained();
+
+  /* Removed entries fall back to their default values */
+  write("app.conf", "host = example.com\n");
+  EXPECT_EQ(config.load(), 2);
+  EXPECT_EQ(*m_options[port], 8080);
+  EXPECT_EQ(*m_options[level], 2);
+  EXPECT_EQ(ports, (std::vector<int>{80, 8080}));
+  EXPECT_EQ(m_options.retained(), retained - 2);
+  EXPECT_EQ(*(*publisher.load())[port], 8080);
+  EXPECT_EQ(m_options.source("port"), cli::Value_source::defaults);
+
+  /* A command line value is kept when the file entry goes away */
+  const char* argv[] = {"program", "--host=cli.example.com"};
+  ASSERT_TRUE(m_options.try_parse(2, const_cast<char**>(argv)));
+  write("app.conf", "port = 81\n");
+  EXPECT_EQ(config.load(), 2);
+  EXPECT_EQ(*m_options[host], "cli.example.com");
+  EXPECT_EQ(config.load(), 0);
+
+  /* An entry can come back */
+  write("app.conf", "port = 81\nlevel = 7\n");
+  EXPECT_EQ(config.load(), 1);
+  EXPECT_EQ(*m_options[level], 7);
+}
+
+TEST_F(Config_file_test, Watch) {
+  auto port = m_options.add_option<int>({.m_long_name = "port", .m_description = "Port number", .m_default_value = 0});
+
+  cli::Config_file config(m_options, write("app.conf", "port = 80\n"));
+  ASSERT_TRUE(config.load());
+  ASSERT_TRUE(config.watch());
+
+  /* Replaced with a rename, like most editors do */
+  write("app.conf.tmp", "port = 8080\n");
+  std::filesystem::rename(m_dir / "app.conf.tmp", m_dir / "app.conf");
+
+  auto changed = config.poll(1000);
+  ASSERT_TRUE(changed);
+  EXPECT_TRUE(*changed);
+  EXPECT_EQ(*m_options[port], 8080);
+
+  auto idle = config.poll(0);
+  ASSERT_TRUE(idle);
+  EXPECT_FALSE(*idle);
+}
+
 int main(int argc, char** argv) {
   testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();